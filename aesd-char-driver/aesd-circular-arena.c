@@ -0,0 +1,137 @@
+/**
+ * @file aesd-circular-arena.c
+ * @brief A circular buffer of commands stored back to back in one contiguous byte arena
+ *
+ * Entries occupy the running byte range [start, start + size) of an ever growing stream,
+ * of which the arena holds the most recent capacity bytes.  Since capacity is a power of
+ * two, a running offset is mapped into the arena with a mask, and an entry or read that
+ * crosses the end of the arena is split into two copies.
+ */
+
+#ifdef __KERNEL__
+#include <linux/errno.h>
+#include <linux/string.h>
+#else
+#include <errno.h>
+#include <string.h>
+#endif
+
+#include "aesd-circular-arena.h"
+
+/**
+ * Copies @param len bytes starting at running offset @param pos out of @param arena
+ */
+static void arena_copy_out(const struct aesd_circular_arena *arena, size_t pos, char *dst, size_t len)
+{
+    size_t at = pos & (arena->capacity - 1);
+    size_t first = arena->capacity - at;
+
+    if (len <= first) {
+        memcpy(dst, arena->data + at, len);
+    }
+    else {
+        memcpy(dst, arena->data + at, first);
+        memcpy(dst + first, arena->data, len - first);
+    }
+}
+
+/**
+ * Initializes @param arena to an empty arena over the caller allocated @param data
+ * @param capacity the size of data in bytes, which must be a power of two
+ * @return 0 on success, -EINVAL if capacity is not a power of two
+ */
+int aesd_circular_arena_init(struct aesd_circular_arena *arena, char *data, size_t capacity)
+{
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        return -EINVAL;
+    }
+    arena->data = data;
+    arena->capacity = capacity;
+    arena->head = 0;
+    aesd_arena_index_init(&arena->index);
+    return 0;
+}
+
+/**
+ * Copies @param size bytes from @param buf into @param arena as a new entry.  The oldest
+ * entries are evicted until the arena has room for the bytes and the index for the entry.
+ * Any necessary locking must be handled by the caller.
+ * @return the number of entries evicted, or -EINVAL if size exceeds the arena capacity
+ */
+int aesd_circular_arena_add_entry(struct aesd_circular_arena *arena, const char *buf, size_t size)
+{
+    struct aesd_arena_entry entry = { .start = arena->head, .size = size };
+    size_t at = arena->head & (arena->capacity - 1);
+    size_t first = arena->capacity - at;
+    int evicted = 0;
+
+    if (size > arena->capacity) {
+        return -EINVAL;
+    }
+    while (aesd_arena_index_total_size(&arena->index) + size > arena->capacity) {
+        aesd_arena_index_pop(&arena->index, NULL);
+        evicted++;
+    }
+    if (size <= first) {
+        memcpy(arena->data + at, buf, size);
+    }
+    else {
+        memcpy(arena->data + at, buf, first);
+        memcpy(arena->data, buf + first, size - first);
+    }
+    // a full index overwrites its oldest entry
+    evicted += aesd_arena_index_add(&arena->index, &entry, NULL);
+    arena->head += size;
+    return evicted;
+}
+
+/**
+ * @param arena the arena to search.  Any necessary locking must be performed by caller.
+ * @param char_offset the zero referenced position if all entries were concatenated end to end
+ * @param entry_offset_byte_rtn set to the byte within the returned entry corresponding to
+ *      char_offset, only when a matching char_offset is found
+ * @return the entry holding char_offset, or NULL if not enough data is stored
+ */
+struct aesd_arena_entry *aesd_circular_arena_find_entry_offset_for_fpos(struct aesd_circular_arena *arena,
+            size_t char_offset, size_t *entry_offset_byte_rtn)
+{
+    return aesd_arena_index_find_fpos(&arena->index, char_offset, entry_offset_byte_rtn);
+}
+
+/**
+ * Copies up to @param len bytes starting at position @param char_offset of the concatenated
+ * entries of @param arena to @param dst, crossing entry boundaries as needed.
+ * Any necessary locking must be performed by caller.
+ * @return the number of bytes copied, 0 when char_offset is at or past the end
+ */
+size_t aesd_circular_arena_read(const struct aesd_circular_arena *arena, size_t char_offset,
+            char *dst, size_t len)
+{
+    size_t total_size = aesd_arena_index_total_size(&arena->index);
+
+    if (char_offset >= total_size) {
+        return 0;
+    }
+    if (len > total_size - char_offset) {
+        len = total_size - char_offset;
+    }
+    // the stored entries are one contiguous run ending at head
+    arena_copy_out(arena, arena->head - total_size + char_offset, dst, len);
+    return len;
+}
+
+/**
+ * @return the number of entries currently stored in @param arena
+ */
+size_t aesd_circular_arena_entry_count(const struct aesd_circular_arena *arena)
+{
+    return aesd_arena_index_count(&arena->index);
+}
+
+/**
+ * @return the sum of the sizes of all entries currently stored in @param arena
+ */
+size_t aesd_circular_arena_total_size(const struct aesd_circular_arena *arena)
+{
+    return aesd_arena_index_total_size(&arena->index);
+}
@@ -0,0 +1,77 @@
+/*
+ * aesd-circular-arena.h
+ *
+ * An alternative to aesd-circular-buffer storing the bytes of every entry in one
+ * contiguous circular byte arena, with an index of entry offsets and lengths.  Adding
+ * a command is a copy into the arena, evicting entries is index arithmetic with no
+ * free, and reads across entries are at most two memcpy calls.
+ */
+
+#ifndef AESD_CIRCULAR_ARENA_H
+#define AESD_CIRCULAR_ARENA_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h> // size_t
+#include <stdint.h> // uintx_t
+#include <stdbool.h>
+#endif
+
+#include "aesd-ring.h"
+
+/**
+ * Log2 of the most entries held in the index, regardless of how much arena space is free
+ */
+#define AESD_ARENA_INDEX_ORDER 10
+
+struct aesd_arena_entry
+{
+    /**
+     * Running byte offset of the first byte of the entry, counted from the first byte
+     * ever added to the arena.  Masked with the arena size to locate it in data.
+     */
+    size_t start;
+    /**
+     * Number of bytes in the entry
+     */
+    size_t size;
+};
+
+AESD_RING_DECLARE_SIZED(aesd_arena_index, struct aesd_arena_entry, AESD_ARENA_INDEX_ORDER, size)
+
+struct aesd_circular_arena
+{
+    /**
+     * Storage for the entry bytes, owned by the caller
+     */
+    char *data;
+    /**
+     * Size of data in bytes, a power of two
+     */
+    size_t capacity;
+    /**
+     * Running byte offset where the next entry will be stored
+     */
+    size_t head;
+    /**
+     * The entries currently in the arena, oldest first
+     */
+    struct aesd_arena_index index;
+};
+
+extern int aesd_circular_arena_init(struct aesd_circular_arena *arena, char *data, size_t capacity);
+
+extern int aesd_circular_arena_add_entry(struct aesd_circular_arena *arena, const char *buf, size_t size);
+
+extern struct aesd_arena_entry *aesd_circular_arena_find_entry_offset_for_fpos(struct aesd_circular_arena *arena,
+            size_t char_offset, size_t *entry_offset_byte_rtn);
+
+extern size_t aesd_circular_arena_read(const struct aesd_circular_arena *arena, size_t char_offset,
+            char *dst, size_t len);
+
+extern size_t aesd_circular_arena_entry_count(const struct aesd_circular_arena *arena);
+
+extern size_t aesd_circular_arena_total_size(const struct aesd_circular_arena *arena);
+
+#endif /* AESD_CIRCULAR_ARENA_H */
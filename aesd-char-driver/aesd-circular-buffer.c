@@ -29,27 +29,114 @@
 struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn )
 {
-	struct aesd_buffer_entry *temp;
-	uint8_t index = buffer->out_offs;
+    size_t low = 0;
+    size_t high = aesd_circular_buffer_entry_count(buffer);
+    uint8_t index;
 
-    while(1) {
-		temp = &buffer->entry[index];
-		if (char_offset < temp->size) {
-			*entry_offset_byte_rtn = char_offset;
-			return temp;
-		}
-		else {
-			char_offset -= temp->size;
-		}
+    if (char_offset >= buffer->total_size) {
+        return NULL;
+    }
+    /*
+     * Binary search for the last entry starting at or before char_offset.  Entry start
+     * offsets increase from out_offs, so index low always starts at or before char_offset
+     * and index high always starts after it.
+     */
+    while (high - low > 1) {
+        size_t mid = low + (high - low) / 2;
+        index = (buffer->out_offs + mid) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        if (buffer->entry_offs[index] - buffer->base_offs <= char_offset) {
+            low = mid;
+        }
+        else {
+            high = mid;
+        }
+    }
+    index = (buffer->out_offs + low) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    *entry_offset_byte_rtn = char_offset - (buffer->entry_offs[index] - buffer->base_offs);
+    return &buffer->entry[index];
+}
+
+/**
+ * @param buffer the buffer to search.  Any necessary locking must be performed by caller.
+ * @param entry_index the zero referenced index of the entry, counted from the oldest entry in the buffer
+ * @param fpos_rtn is a pointer specifying a location to store the position of the first byte of the
+ *      entry, as a zero referenced character index if all buffer strings were concatenated end to end.
+ *      Only set when @param entry_index is in the buffer.
+ * @return the struct aesd_buffer_entry structure at @param entry_index, or NULL if the buffer does
+ *      not hold that many entries.
+ */
+struct aesd_buffer_entry *aesd_circular_buffer_find_fpos_for_entry(struct aesd_circular_buffer *buffer,
+            size_t entry_index, size_t *fpos_rtn)
+{
+    uint8_t index;
+
+    if (entry_index >= aesd_circular_buffer_entry_count(buffer)) {
+        return NULL;
+    }
+    index = (buffer->out_offs + entry_index) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    *fpos_rtn = buffer->entry_offs[index] - buffer->base_offs;
+    return &buffer->entry[index];
+}
 
-        index++;
-        index = index % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-        if(index == buffer->in_offs) {
-            break;
+/**
+ * Describes the byte range [char_offset, char_offset + len) of the concatenated entries as
+ * one segment per entry it covers, in order, with a single position search.
+ * @param buffer the buffer to describe.  Any necessary locking must be performed by caller,
+ *      and the segments are only valid while it is held.
+ * @param char_offset the zero referenced start of the range if all buffer strings were
+ *      concatenated end to end
+ * @param len the length of the range, which is cut short at the end of the buffer
+ * @param segments an array to fill with up to @param max_segments segments.
+ *      AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED segments always cover the whole range.
+ * @param bytes_rtn if not NULL, set to the number of bytes covered by the segments
+ * @return the number of segments filled, 0 if char_offset is not in the buffer
+ */
+size_t aesd_circular_buffer_segments(struct aesd_circular_buffer *buffer, size_t char_offset,
+            size_t len, struct aesd_buffer_segment *segments, size_t max_segments, size_t *bytes_rtn)
+{
+    struct aesd_buffer_entry *entry;
+    size_t entry_offset;
+    size_t entry_index;
+    size_t count = 0;
+    size_t bytes = 0;
+    uint8_t index;
+
+    entry = aesd_circular_buffer_find_entry_offset_for_fpos(buffer, char_offset, &entry_offset);
+    if (entry != NULL) {
+        index = entry - buffer->entry;
+        entry_index = (index + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - buffer->out_offs)
+                % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        while (bytes < len && count < max_segments
+                && entry_index < aesd_circular_buffer_entry_count(buffer)) {
+            entry = &buffer->entry[index];
+            segments[count].ptr = entry->buffptr + entry_offset;
+            segments[count].len = entry->size - entry_offset;
+            if (segments[count].len > len - bytes) {
+                segments[count].len = len - bytes;
+            }
+            bytes += segments[count].len;
+            count++;
+            entry_offset = 0;
+            entry_index++;
+            index = (index + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
         }
-	} 
+    }
+    if (bytes_rtn != NULL) {
+        *bytes_rtn = bytes;
+    }
+    return count;
+}
 
-    return NULL;
+/**
+ * @return the number of entries currently stored in @param buffer
+ */
+size_t aesd_circular_buffer_entry_count(const struct aesd_circular_buffer *buffer)
+{
+    if (buffer->full) {
+        return AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    }
+    return (buffer->in_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - buffer->out_offs)
+            % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
 }
 
 /**
@@ -65,12 +152,14 @@ const char * aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer,
     if (buffer->full) {
         buffer_return = buffer->entry[buffer->out_offs].buffptr;
         buffer->total_size -= buffer->entry[buffer->out_offs].size;
+        buffer->base_offs += buffer->entry[buffer->out_offs].size;
         buffer->out_offs++;
         buffer->out_offs = buffer->out_offs % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
     }
 
     buffer->entry[buffer->in_offs] = *add_entry;
     buffer->entry[buffer->in_offs].size = add_entry->size;
+    buffer->entry_offs[buffer->in_offs] = buffer->base_offs + buffer->total_size;
     buffer->total_size += buffer->entry[buffer->in_offs].size;
     buffer->in_offs++;
     buffer->in_offs = buffer->in_offs % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
@@ -30,6 +30,16 @@ struct aesd_buffer_entry
     size_t size;
 };
 
+/**
+ * A contiguous run of bytes stored in the buffer, one piece of a byte range which may
+ * span several entries
+ */
+struct aesd_buffer_segment
+{
+    const char *ptr;
+    size_t len;
+};
+
 struct aesd_circular_buffer
 {
     /**
@@ -49,12 +59,34 @@ struct aesd_circular_buffer
      * set to true when the buffer entry structure is full
      */
     bool full;
+    /**
+     * Sum of the sizes of all entries currently in the buffer
+     */
     size_t total_size;
+    /**
+     * Running byte offset of the start of each entry, counted from the first byte ever
+     * added to the buffer.  Subtracting base_offs gives the entry's position in the
+     * concatenation of all entries, so position lookups need no walk over entry sizes.
+     * Unsigned wraparound cancels out in the subtraction.
+     */
+    size_t entry_offs[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    /**
+     * Running byte offset of the first byte of the entry at out_offs
+     */
+    size_t base_offs;
 };
 
 extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn );
 
+extern struct aesd_buffer_entry *aesd_circular_buffer_find_fpos_for_entry(struct aesd_circular_buffer *buffer,
+            size_t entry_index, size_t *fpos_rtn);
+
+extern size_t aesd_circular_buffer_segments(struct aesd_circular_buffer *buffer, size_t char_offset,
+            size_t len, struct aesd_buffer_segment *segments, size_t max_segments, size_t *bytes_rtn);
+
+extern size_t aesd_circular_buffer_entry_count(const struct aesd_circular_buffer *buffer);
+
 extern const char * aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry);
 
 extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
@@ -0,0 +1,237 @@
+/*
+ * aesd-ring.h
+ *
+ * A type generic ring of fixed, power of two capacity, generated by macros so the driver
+ * and aesdsocket can keep rings of their own element types without rewriting the index
+ * arithmetic.  Follows the aesd-circular-buffer model: adding to a full ring overwrites
+ * the oldest element, and any necessary locking must be performed by the caller.
+ *
+ * The head and tail indices are free running uint32_t counters.  Slots are selected with
+ * a mask instead of a modulo, the element count is head - tail even across wraparound,
+ * and no full flag is needed, so capacities up to 2^31 elements are possible.
+ *
+ * Example usage:
+ * AESD_RING_DECLARE(cmd_ring, struct aesd_buffer_entry, 10)   // 1024 entries
+ * struct cmd_ring ring;
+ * struct aesd_buffer_entry evicted;
+ * cmd_ring_init(&ring);
+ * if (cmd_ring_add(&ring, &entry, &evicted)) {
+ *      free(evicted.buffptr);
+ * }
+ */
+
+#ifndef AESD_RING_H
+#define AESD_RING_H
+
+#ifdef __KERNEL__
+#include <linux/string.h>
+#include <linux/types.h>
+#else
+#include <stdbool.h>
+#include <stddef.h> // size_t
+#include <stdint.h> // uintx_t
+#include <string.h>
+#endif
+
+#define AESD_RING_CAPACITY(order) (1u << (order))
+
+/**
+ * Declares struct @param name holding up to 2^@param order elements of @param type, and
+ * static inline functions prefixed with @param name:
+ * _init(ring)                      empties the ring
+ * _count(ring)                     number of elements stored
+ * _full(ring)                      true when the next add overwrites the oldest element
+ * _at(ring, index)                 the element @param index places after the oldest, or NULL
+ * _add(ring, elem, evicted_rtn)    appends a copy of elem, returns true and copies the
+ *                                  overwritten element to evicted_rtn (if not NULL) when full
+ * _pop(ring, elem_rtn)             removes the oldest element, returns false when empty
+ */
+#define AESD_RING_DECLARE(name, type, order)                                                \
+struct name                                                                                 \
+{                                                                                           \
+    type elem[AESD_RING_CAPACITY(order)];                                                   \
+    /* Free running count of elements ever added */                                         \
+    uint32_t head;                                                                          \
+    /* Free running count of elements ever removed or overwritten */                        \
+    uint32_t tail;                                                                          \
+};                                                                                          \
+                                                                                            \
+static inline void name##_init(struct name *ring)                                           \
+{                                                                                           \
+    memset(ring, 0, sizeof(*ring));                                                         \
+}                                                                                           \
+                                                                                            \
+static inline uint32_t name##_count(const struct name *ring)                                \
+{                                                                                           \
+    return ring->head - ring->tail;                                                         \
+}                                                                                           \
+                                                                                            \
+static inline bool name##_full(const struct name *ring)                                     \
+{                                                                                           \
+    return name##_count(ring) == AESD_RING_CAPACITY(order);                                 \
+}                                                                                           \
+                                                                                            \
+static inline uint32_t name##_slot(uint32_t counter)                                        \
+{                                                                                           \
+    return counter & (AESD_RING_CAPACITY(order) - 1);                                       \
+}                                                                                           \
+                                                                                            \
+static inline type *name##_at(struct name *ring, uint32_t index)                            \
+{                                                                                           \
+    if (index >= name##_count(ring)) {                                                      \
+        return NULL;                                                                        \
+    }                                                                                       \
+    return &ring->elem[name##_slot(ring->tail + index)];                                    \
+}                                                                                           \
+                                                                                            \
+static inline bool name##_add(struct name *ring, const type *elem, type *evicted_rtn)       \
+{                                                                                           \
+    bool evicted = false;                                                                   \
+    if (name##_full(ring)) {                                                                \
+        if (evicted_rtn != NULL) {                                                          \
+            *evicted_rtn = ring->elem[name##_slot(ring->tail)];                             \
+        }                                                                                   \
+        ring->tail++;                                                                       \
+        evicted = true;                                                                     \
+    }                                                                                       \
+    ring->elem[name##_slot(ring->head)] = *elem;                                            \
+    ring->head++;                                                                           \
+    return evicted;                                                                         \
+}                                                                                           \
+                                                                                            \
+static inline bool name##_pop(struct name *ring, type *elem_rtn)                            \
+{                                                                                           \
+    if (name##_count(ring) == 0) {                                                          \
+        return false;                                                                       \
+    }                                                                                       \
+    if (elem_rtn != NULL) {                                                                 \
+        *elem_rtn = ring->elem[name##_slot(ring->tail)];                                    \
+    }                                                                                       \
+    ring->tail++;                                                                           \
+    return true;                                                                            \
+}
+
+/**
+ * Declares a ring as AESD_RING_DECLARE does, for an element type with a size_t member
+ * @param size_member giving its length in bytes, plus the position lookups of
+ * aesd-circular-buffer over the concatenation of all stored elements:
+ * _total_size(ring)                            sum of the sizes of the stored elements
+ * _find_fpos(ring, char_offset, offset_rtn)    element holding byte char_offset, or NULL
+ * _fpos_for(ring, index, fpos_rtn)             element at index and the position of its
+ *                                              first byte, or NULL
+ * Running start offsets are kept per slot, so lookups are a binary search.
+ */
+#define AESD_RING_DECLARE_SIZED(name, type, order, size_member)                            \
+AESD_RING_DECLARE(name##_elems, type, order)                                                \
+                                                                                            \
+struct name                                                                                 \
+{                                                                                           \
+    struct name##_elems ring;                                                               \
+    /* Running byte offset of the start of each element, from the first byte ever added */ \
+    size_t offs[AESD_RING_CAPACITY(order)];                                                 \
+    /* Running byte offset of the first byte of the oldest element */                       \
+    size_t base_offs;                                                                       \
+    size_t total_size;                                                                      \
+};                                                                                          \
+                                                                                            \
+static inline void name##_init(struct name *ring)                                           \
+{                                                                                           \
+    memset(ring, 0, sizeof(*ring));                                                         \
+}                                                                                           \
+                                                                                            \
+static inline uint32_t name##_count(const struct name *ring)                                \
+{                                                                                           \
+    return name##_elems_count(&ring->ring);                                                 \
+}                                                                                           \
+                                                                                            \
+static inline size_t name##_total_size(const struct name *ring)                             \
+{                                                                                           \
+    return ring->total_size;                                                                \
+}                                                                                           \
+                                                                                            \
+static inline type *name##_at(struct name *ring, uint32_t index)                            \
+{                                                                                           \
+    return name##_elems_at(&ring->ring, index);                                             \
+}                                                                                           \
+                                                                                            \
+static inline bool name##_add(struct name *ring, const type *elem, type *evicted_rtn)       \
+{                                                                                           \
+    type evicted;                                                                           \
+    bool full = name##_elems_add(&ring->ring, elem, &evicted);                              \
+    if (full) {                                                                             \
+        ring->base_offs += evicted.size_member;                                             \
+        ring->total_size -= evicted.size_member;                                            \
+        if (evicted_rtn != NULL) {                                                          \
+            *evicted_rtn = evicted;                                                         \
+        }                                                                                   \
+    }                                                                                       \
+    ring->offs[name##_elems_slot(ring->ring.head - 1)] = ring->base_offs + ring->total_size; \
+    ring->total_size += elem->size_member;                                                  \
+    return full;                                                                            \
+}                                                                                           \
+                                                                                            \
+static inline bool name##_pop(struct name *ring, type *elem_rtn)                            \
+{                                                                                           \
+    type popped;                                                                            \
+    if (!name##_elems_pop(&ring->ring, &popped)) {                                          \
+        return false;                                                                       \
+    }                                                                                       \
+    ring->base_offs += popped.size_member;                                                  \
+    ring->total_size -= popped.size_member;                                                 \
+    if (elem_rtn != NULL) {                                                                 \
+        *elem_rtn = popped;                                                                 \
+    }                                                                                       \
+    return true;                                                                            \
+}                                                                                           \
+                                                                                            \
+static inline type *name##_fpos_for(struct name *ring, uint32_t index, size_t *fpos_rtn)    \
+{                                                                                           \
+    type *elem = name##_at(ring, index);                                                    \
+    if (elem != NULL) {                                                                     \
+        *fpos_rtn = ring->offs[name##_elems_slot(ring->ring.tail + index)] - ring->base_offs; \
+    }                                                                                       \
+    return elem;                                                                            \
+}                                                                                           \
+                                                                                            \
+static inline type *name##_find_fpos(struct name *ring, size_t char_offset,                 \
+        size_t *offset_rtn)                                                                 \
+{                                                                                           \
+    uint32_t low = 0;                                                                       \
+    uint32_t high = name##_count(ring);                                                     \
+    size_t fpos = 0;                                                                        \
+    type *elem;                                                                             \
+    if (char_offset >= ring->total_size) {                                                  \
+        return NULL;                                                                        \
+    }                                                                                       \
+    while (high - low > 1) {                                                                \
+        uint32_t mid = low + (high - low) / 2;                                              \
+        if (ring->offs[name##_elems_slot(ring->ring.tail + mid)] - ring->base_offs          \
+                <= char_offset) {                                                           \
+            low = mid;                                                                      \
+        }                                                                                   \
+        else {                                                                              \
+            high = mid;                                                                     \
+        }                                                                                   \
+    }                                                                                       \
+    elem = name##_fpos_for(ring, low, &fpos);                                               \
+    *offset_rtn = char_offset - fpos;                                                       \
+    return elem;                                                                            \
+}
+
+/**
+ * Create a for loop to iterate over the elements of a ring from oldest to newest.
+ * @param elemptr is a pointer of the element type set to the current element
+ * @param name is the name the ring was declared with
+ * @param ring is a struct name * describing the ring
+ * @param index is a uint32_t stack allocated value used by this macro for an index
+ * Example usage:
+ * uint32_t index;
+ * struct aesd_buffer_entry *entry;
+ * AESD_RING_FOREACH(entry, cmd_ring, &ring, index) {
+ *      free(entry->buffptr);
+ * }
+ */
+#define AESD_RING_FOREACH(elemptr, name, ring, index) \
+    for (index = 0; (elemptr = name##_at(ring, index)) != NULL; index++)
+
+#endif /* AESD_RING_H */
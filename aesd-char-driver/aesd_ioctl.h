@@ -33,14 +33,81 @@ struct aesd_seekto {
     uint32_t write_cmd_offset;
 };
 
+/**
+ * A structure passed by IOCTL to describe the commands stored on the aesdchar driver in one call
+ */
+struct aesd_info {
+    /**
+     * Incremented for every command written, an unchanged generation means unchanged contents
+     */
+    uint64_t generation;
+    /**
+     * The number of bytes stored, which is also the end of file for llseek
+     */
+    uint64_t total_size;
+    /**
+     * The number of commands stored
+     */
+    uint32_t entry_count;
+    /**
+     * In: the number of elements available at entry_sizes.
+     * Out: the number of sizes written, at most entry_count
+     */
+    uint32_t entry_sizes_len;
+    /**
+     * Address of a uint32_t array receiving the size of each command, oldest first
+     */
+    uint64_t entry_sizes;
+};
+
+/**
+ * A structure passed by IOCTL describing a user buffer holding a snapshot image of the
+ * commands stored on the aesdchar driver
+ */
+struct aesd_image {
+    /**
+     * Address of the image
+     */
+    uint64_t buf;
+    /**
+     * The length of the buffer at buf.  AESDCHAR_IOCSNAPSHOT sets it to the image length,
+     * also when failing with ENOSPC because the buffer is too small.
+     */
+    uint64_t buf_len;
+};
+
+#define AESD_IMAGE_MAGIC 0x44534541 /* "AESD" in little endian */
+#define AESD_IMAGE_VERSION 1
+
+/**
+ * A snapshot image starts with this header, followed by entry_count records, oldest command
+ * first, of a uint32_t command size followed by the command bytes.  Fields are native endian.
+ */
+struct aesd_image_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entry_count;
+    uint64_t total_size;
+    /**
+     * The commit generation when the snapshot was taken, see struct aesd_info
+     */
+    uint64_t generation;
+};
+
 // Pick an arbitrary unused value from https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
 #define AESD_IOC_MAGIC 0x16
 
 // Define a write command from the user point of view, use command number 1
 #define AESDCHAR_IOCSEEKTO _IOWR(AESD_IOC_MAGIC, 1, struct aesd_seekto)
+// Report the commands stored, see struct aesd_info
+#define AESDCHAR_IOCINFO _IOWR(AESD_IOC_MAGIC, 2, struct aesd_info)
+// Serialize the stored commands into a snapshot image, see struct aesd_image_header
+#define AESDCHAR_IOCSNAPSHOT _IOWR(AESD_IOC_MAGIC, 3, struct aesd_image)
+// Replace the stored commands with those of a snapshot image
+#define AESDCHAR_IOCRESTORE _IOW(AESD_IOC_MAGIC, 4, struct aesd_image)
 /**
  * The maximum number of commands supported, used for bounds checking
  */
-#define AESDCHAR_IOC_MAXNR 1
+#define AESDCHAR_IOC_MAXNR 4
 
 #endif /* AESD_IOCTL_H */
@@ -0,0 +1,229 @@
+/**
+ * @file aesdchar-bench.c
+ * @brief Microbenchmarks of the aesdchar read, write and seek logic, built in user space
+ * from aesdchar-core.c.
+ *
+ * Usage: aesdchar-bench [iterations]
+ * Prints one line per workload with the time and the allocator calls per operation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "aesdchar.h"
+#include "aesd-ring.h"
+#include "aesd-circular-arena.h"
+
+#define DEFAULT_ITERATIONS 200000
+#define BENCH_ARENA_SIZE 65536
+
+unsigned long aesd_user_alloc_count;
+
+/* 1024 commands, a capacity aesd-circular-buffer's uint8_t indices cannot reach */
+AESD_RING_DECLARE_SIZED(bench_ring, struct aesd_buffer_entry, 10, size)
+
+struct bench_ctx
+{
+    struct aesd_dev dev;
+    struct aesd_file file;
+    struct file filp;
+    struct kiocb iocb;
+    struct aesd_circular_arena arena;
+    char arena_data[BENCH_ARENA_SIZE];
+    char data[4096];
+    char readbuf[8192];
+};
+
+typedef void (*bench_op)(struct bench_ctx *ctx, unsigned long iteration);
+
+static ssize_t bench_write(struct bench_ctx *ctx, const char *buf, size_t len)
+{
+    struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+    struct iov_iter iter;
+
+    iov_iter_init(&iter, WRITE, &iov, 1, len);
+    ctx->iocb.ki_pos = ctx->filp.f_pos;
+    return aesd_write_iter(&ctx->iocb, &iter);
+}
+
+static ssize_t bench_read(struct bench_ctx *ctx, size_t len)
+{
+    struct iovec iov = { .iov_base = ctx->readbuf, .iov_len = len };
+    struct iov_iter iter;
+    ssize_t rc;
+
+    iov_iter_init(&iter, READ, &iov, 1, len);
+    ctx->iocb.ki_pos = ctx->filp.f_pos;
+    rc = aesd_read_iter(&ctx->iocb, &iter);
+    ctx->filp.f_pos = ctx->iocb.ki_pos;
+    return rc;
+}
+
+/**
+ * @return a command of @param size bytes ending in a newline, stored in ctx->data
+ */
+static const char *bench_command(struct bench_ctx *ctx, size_t size)
+{
+    memset(ctx->data, 'a' + (size % 26), size - 1);
+    ctx->data[size - 1] = '\n';
+    return ctx->data;
+}
+
+static void op_write_16(struct bench_ctx *ctx, unsigned long iteration)
+{
+    bench_write(ctx, bench_command(ctx, 16), 16);
+}
+
+static void op_write_256(struct bench_ctx *ctx, unsigned long iteration)
+{
+    bench_write(ctx, bench_command(ctx, 256), 256);
+}
+
+static void op_write_2048(struct bench_ctx *ctx, unsigned long iteration)
+{
+    bench_write(ctx, bench_command(ctx, 2048), 2048);
+}
+
+/* A 128 byte command arriving in four fragments */
+static void op_write_partial(struct bench_ctx *ctx, unsigned long iteration)
+{
+    const char *cmd = bench_command(ctx, 128);
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        bench_write(ctx, cmd + i * 32, 32);
+    }
+}
+
+static void op_read_all(struct bench_ctx *ctx, unsigned long iteration)
+{
+    aesd_llseek(&ctx->filp, 0, SEEK_SET);
+    while (bench_read(ctx, sizeof(ctx->readbuf)) > 0) {
+    }
+}
+
+static void op_seekto_read(struct bench_ctx *ctx, unsigned long iteration)
+{
+    long fpos;
+
+    mutex_lock(&ctx->dev.read_write_mutex);
+    fpos = aesd_adjust_file_offset(&ctx->filp, iteration % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, 1);
+    mutex_unlock(&ctx->dev.read_write_mutex);
+    if (fpos >= 0) {
+        ctx->filp.f_pos = fpos;
+    }
+    bench_read(ctx, 64);
+}
+
+/* What an aesdsocket connection does: append a command, optionally seek, replay */
+static void op_mixed(struct bench_ctx *ctx, unsigned long iteration)
+{
+    bench_write(ctx, bench_command(ctx, 64), 64);
+    if (iteration % 4 == 0) {
+        op_seekto_read(ctx, iteration);
+    }
+    else {
+        op_read_all(ctx, iteration);
+    }
+    aesd_llseek(&ctx->filp, 0, SEEK_END);
+}
+
+/* Add and position lookups on a 1024 entry ring, without the driver around it */
+static void op_ring_add_find(struct bench_ctx *ctx, unsigned long iteration)
+{
+    static struct bench_ring ring;
+    struct aesd_buffer_entry entry = { .buffptr = ctx->data, .size = 64 + iteration % 64 };
+    size_t offset;
+
+    bench_ring_add(&ring, &entry, NULL);
+    bench_ring_find_fpos(&ring, (iteration * 7919) % bench_ring_total_size(&ring), &offset);
+}
+
+static void op_arena_write_256(struct bench_ctx *ctx, unsigned long iteration)
+{
+    aesd_circular_arena_add_entry(&ctx->arena, bench_command(ctx, 256), 256);
+}
+
+/* The same sequential read as read_all, over entries stored in the arena */
+static void op_arena_read_all(struct bench_ctx *ctx, unsigned long iteration)
+{
+    size_t fpos = 0;
+    size_t rc;
+
+    while ((rc = aesd_circular_arena_read(&ctx->arena, fpos, ctx->readbuf, sizeof(ctx->readbuf))) > 0) {
+        fpos += rc;
+    }
+}
+
+static int bench_setup(struct bench_ctx *ctx, bool prefill)
+{
+    int i;
+
+    memset(ctx, 0, sizeof(*ctx));
+    if (aesd_init_device(&ctx->dev) != 0) {
+        return -1;
+    }
+    aesd_init_file(&ctx->file, &ctx->dev);
+    ctx->filp.private_data = &ctx->file;
+    ctx->iocb.ki_filp = &ctx->filp;
+    aesd_circular_arena_init(&ctx->arena, ctx->arena_data, sizeof(ctx->arena_data));
+    for (i = 0; prefill && i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++) {
+        bench_write(ctx, bench_command(ctx, 100), 100);
+        aesd_circular_arena_add_entry(&ctx->arena, ctx->data, 100);
+    }
+    return 0;
+}
+
+static void bench_run(const char *name, bench_op op, bool prefill, unsigned long iterations)
+{
+    static struct bench_ctx ctx;
+    unsigned long allocs;
+    unsigned long i;
+    u64 start;
+    u64 elapsed;
+
+    if (bench_setup(&ctx, prefill) != 0) {
+        fprintf(stderr, "%s: setup failed\n", name);
+        return;
+    }
+    // a warm up pass fills the ring so steady state eviction is measured
+    for (i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * 2; i++) {
+        op(&ctx, i);
+    }
+    allocs = aesd_user_alloc_count;
+    start = ktime_get_ns();
+    for (i = 0; i < iterations; i++) {
+        op(&ctx, i);
+    }
+    elapsed = ktime_get_ns() - start;
+    allocs = aesd_user_alloc_count - allocs;
+    printf("%-16s %10.1f ns/op %8.3f allocs/op\n", name,
+           (double)elapsed / iterations, (double)allocs / iterations);
+    aesd_cleanup_file(&ctx.file);
+    aesd_cleanup_device(&ctx.dev);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long iterations = DEFAULT_ITERATIONS;
+
+    if (argc > 1) {
+        iterations = strtoul(argv[1], NULL, 0);
+    }
+    if (iterations == 0 || aesd_entry_cache_create() != 0) {
+        fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+    bench_run("write_16", op_write_16, false, iterations);
+    bench_run("write_256", op_write_256, false, iterations);
+    bench_run("write_2048", op_write_2048, false, iterations);
+    bench_run("write_partial", op_write_partial, false, iterations);
+    bench_run("read_all", op_read_all, true, iterations);
+    bench_run("seekto_read", op_seekto_read, true, iterations);
+    bench_run("mixed", op_mixed, true, iterations);
+    bench_run("ring_add_find", op_ring_add_find, false, iterations);
+    bench_run("arena_write_256", op_arena_write_256, false, iterations);
+    bench_run("arena_read_all", op_arena_read_all, true, iterations);
+    aesd_entry_cache_destroy();
+    return 0;
+}
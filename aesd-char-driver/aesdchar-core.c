@@ -0,0 +1,468 @@
+/**
+ * @file aesdchar-core.c
+ * @brief The read, write and seek logic of the AESD char driver
+ *
+ * Kept free of module and character device registration, which live in main.c, so the
+ * same source builds into the kernel module and, with __KERNEL__ undefined and the
+ * stand-ins from aesdchar-user.h, into user space programs such as aesdchar-bench.
+ *
+ */
+
+#ifdef __KERNEL__
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/wait.h>
+#include <linux/sched/signal.h>
+#include <linux/uio.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/printk.h>
+#endif
+#include "aesdchar.h"
+#ifdef __KERNEL__
+#include "aesdchar-trace.h"
+#endif
+
+/**
+ * When set, a read at the end of the buffer blocks until the next command is
+ * committed (tail -f semantics) instead of returning 0.  O_NONBLOCK readers get -EAGAIN.
+ */
+bool tail_reads = false;
+module_param(tail_reads, bool, 0644);
+MODULE_PARM_DESC(tail_reads, "Block reads at the end of the buffer until a new command is written");
+
+static struct kmem_cache *aesd_entry_cache;
+
+/**
+ * Creates the cache aesd_entry_alloc serves command storage from
+ * @return 0 on success, -ENOMEM on failure
+ */
+int aesd_entry_cache_create(void)
+{
+    aesd_entry_cache = kmem_cache_create_usercopy("aesdchar_entry", AESD_ENTRY_CHUNK_SIZE,
+            0, SLAB_HWCACHE_ALIGN, 0, AESD_ENTRY_CHUNK_SIZE, NULL);
+    return aesd_entry_cache == NULL ? -ENOMEM : 0;
+}
+
+/**
+ * Destroys the cache created by aesd_entry_cache_create, once every device is cleaned up
+ */
+void aesd_entry_cache_destroy(void)
+{
+    if (aesd_entry_cache != NULL) {
+        kmem_cache_destroy(aesd_entry_cache);
+        aesd_entry_cache = NULL;
+    }
+}
+
+/**
+ * @return the struct aesd_stats latency histogram bucket for an operation taking @param ns
+ */
+static inline unsigned int aesd_latency_bucket(u64 ns)
+{
+    if (ns < 256) {
+        return 0;
+    }
+    return min_t(unsigned int, ilog2(ns) - 7, AESD_LATENCY_BUCKETS - 1);
+}
+
+/**
+ * Locks dev->read_write_mutex, accounting the time spent waiting in dev->stats
+ * @param interruptible whether a signal may abort the wait
+ * @return 0 on success, -ERESTARTSYS if interrupted by a signal
+ */
+int aesd_lock_timed(struct aesd_dev *dev, bool interruptible)
+{
+    u64 start = ktime_get_ns();
+
+    if (!interruptible) {
+        mutex_lock(&dev->read_write_mutex);
+    }
+    else if (mutex_lock_interruptible(&dev->read_write_mutex)) {
+        return -ERESTARTSYS;
+    }
+    this_cpu_add(dev->stats->lock_wait_ns, ktime_get_ns() - start);
+    this_cpu_inc(dev->stats->lock_acquisitions);
+    return 0;
+}
+
+/**
+ * @param dev the device the entry will be stored in
+ * @param size the number of bytes needed
+ * @return storage for an entry of @param size bytes.  Sizes up to AESD_ENTRY_CHUNK_SIZE
+ *   are served from the chunks recycled from evicted entries, then from aesd_entry_cache,
+ *   anything larger from kmalloc.  Release with aesd_entry_free using the same size class.
+ */
+char *aesd_entry_alloc(struct aesd_dev *dev, size_t size)
+{
+    char *chunk = NULL;
+
+    if (size > AESD_ENTRY_CHUNK_SIZE) {
+        return kmalloc(size, GFP_KERNEL);
+    }
+    spin_lock(&dev->pool_lock);
+    if (dev->free_count > 0) {
+        chunk = dev->free_chunks[--dev->free_count];
+    }
+    spin_unlock(&dev->pool_lock);
+    if (chunk == NULL) {
+        chunk = kmem_cache_alloc(aesd_entry_cache, GFP_KERNEL);
+    }
+    return chunk;
+}
+
+/**
+ * Releases @param buffptr holding @param size bytes, allocated by aesd_entry_alloc.
+ * Cache objects are kept on dev->free_chunks for reuse while there is room.
+ */
+void aesd_entry_free(struct aesd_dev *dev, const char *buffptr, size_t size)
+{
+    if (buffptr == NULL) {
+        return;
+    }
+    if (size > AESD_ENTRY_CHUNK_SIZE) {
+        kfree(buffptr);
+        return;
+    }
+    spin_lock(&dev->pool_lock);
+    if (dev->free_count < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) {
+        dev->free_chunks[dev->free_count++] = (char *)buffptr;
+        buffptr = NULL;
+    }
+    spin_unlock(&dev->pool_lock);
+    if (buffptr != NULL) {
+        kmem_cache_free(aesd_entry_cache, (void *)buffptr);
+    }
+}
+
+/**
+ * @param dev the device to inspect.  Caller holds dev->read_write_mutex.
+ * @param new_entries the number of commands committed since a reader reached the end
+ * @return the file position of the oldest of the @param new_entries most recent commands,
+ *   or 0 when more commands than the buffer holds have been committed.
+ */
+static loff_t aesd_fpos_of_newest(struct aesd_dev *dev, u64 new_entries)
+{
+    size_t count = aesd_circular_buffer_entry_count(&dev->buffer);
+    size_t fpos = 0;
+
+    if (new_entries < count) {
+        aesd_circular_buffer_find_fpos_for_entry(&dev->buffer, count - new_entries, &fpos);
+    }
+    return fpos;
+}
+
+ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    struct file *filp = iocb->ki_filp;
+    loff_t *f_pos = &iocb->ki_pos;
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    struct aesd_buffer_entry *read_buffer;
+    struct aesd_buffer_segment segments[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    size_t nr_segments = 0;
+    size_t offset;
+    size_t i;
+    ssize_t retval = 0;
+    loff_t pos;
+    u64 start = ktime_get_ns();
+    PDEBUG("read %zu bytes with offset %lld",iov_iter_count(to),*f_pos);
+
+    //mutex lock
+    if (aesd_lock_timed(dev, true)) {
+        return -ERESTARTSYS;
+    }
+    read_buffer = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->buffer, *f_pos, &offset);
+    while (read_buffer == NULL && tail_reads) {
+        u64 seen = file->read_generation;
+        if (seen == dev->commit_count) {
+            mutex_unlock(&dev->read_write_mutex);
+            if ((filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT)) {
+                return -EAGAIN;
+            }
+            if (wait_event_interruptible(dev->read_queue, READ_ONCE(dev->commit_count) != seen)) {
+                return -ERESTARTSYS;
+            }
+            // time spent sleeping for data is not read latency
+            start = ktime_get_ns();
+            if (aesd_lock_timed(dev, true)) {
+                return -ERESTARTSYS;
+            }
+        }
+        // positions shift as old commands are evicted, so resume at the first new command
+        *f_pos = aesd_fpos_of_newest(dev, dev->commit_count - seen);
+        file->read_generation = dev->commit_count;
+        read_buffer = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->buffer, *f_pos, &offset);
+    }
+    pos = *f_pos;
+    // fill the iterator from every command the requested range covers
+    if (read_buffer != NULL) {
+        nr_segments = aesd_circular_buffer_segments(&dev->buffer, *f_pos, iov_iter_count(to),
+                segments, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, NULL);
+    }
+    for (i = 0; i < nr_segments; i++) {
+        size_t copied = copy_to_iter(segments[i].ptr, segments[i].len, to);
+        retval += copied;
+        if (copied != segments[i].len) {
+            if (retval == 0) {
+                retval = -EFAULT;
+            }
+            break;
+        }
+    }
+    if (retval > 0) {
+        *f_pos = *f_pos + retval;
+        this_cpu_add(dev->stats->bytes_read, retval);
+    }
+    if (*f_pos >= dev->buffer.total_size) {
+        file->read_generation = dev->commit_count;
+    }
+    
+    mutex_unlock(&dev->read_write_mutex);
+    start = ktime_get_ns() - start;
+    this_cpu_inc(dev->stats->read_latency[aesd_latency_bucket(start)]);
+    trace_aesd_read(filp, pos, iov_iter_count(to) + max_t(ssize_t, retval, 0), retval, start);
+    return retval;
+}
+
+/**
+ * Moves the command left unterminated by a writer which closed @param dev into the empty
+ * @param entry, so writes from a later open continue it as they would on a regular file
+ */
+static void aesd_adopt_partial(struct aesd_dev *dev, struct aesd_buffer_entry *entry)
+{
+    mutex_lock(&dev->read_write_mutex);
+    *entry = dev->entry;
+    dev->entry.buffptr = NULL;
+    dev->entry.size = 0;
+    mutex_unlock(&dev->read_write_mutex);
+}
+
+ssize_t aesd_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct file *filp = iocb->ki_filp;
+    loff_t *f_pos = &iocb->ki_pos;
+    size_t count = iov_iter_count(from);
+    ssize_t retval = -ENOMEM;
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    struct aesd_buffer_entry *entry = &file->entry;
+    size_t size;
+    size_t new_size;
+    char *buffptr;
+    bool committed = false;
+    u64 start = ktime_get_ns();
+    PDEBUG("write %zu bytes with offset %lld",count,*f_pos);
+    if (count == 0) {
+        return 0;
+    }
+    /**
+     * Partial commands accumulate in the writer's own struct aesd_file, so concurrent
+     * writers never interleave their fragments.  Only the final commit to the buffer
+     * takes the device lock.
+     */
+    if (mutex_lock_interruptible(&file->write_mutex)) {
+        return -ERESTARTSYS;
+    }
+    if (entry->size == 0 && READ_ONCE(dev->entry.size) != 0) {
+        aesd_adopt_partial(dev, entry);
+    }
+    size = entry->size;
+    new_size = size + count;
+    /**
+     * The size class of an entry identifies its allocator (see aesd_entry_alloc), so a
+     * partial command which outgrows its cache object moves to kmalloc only once the
+     * new bytes are safely copied in.  A faulting copy leaves the entry untouched,
+     * and every segment of the iterator is gathered into the same command.
+     */
+    if (size == 0) {
+        buffptr = aesd_entry_alloc(dev, new_size);
+    }
+    else if (new_size <= AESD_ENTRY_CHUNK_SIZE) {
+        buffptr = (char *)entry->buffptr;
+    }
+    else if (size <= AESD_ENTRY_CHUNK_SIZE) {
+        buffptr = kmalloc(new_size, GFP_KERNEL);
+    }
+    else {
+        buffptr = krealloc(entry->buffptr, new_size, GFP_KERNEL);
+        if (buffptr != NULL) {
+            entry->buffptr = buffptr;
+        }
+    }
+    if (buffptr == NULL) {
+        mutex_unlock(&file->write_mutex);
+        return retval;
+    }
+
+    if (copy_from_iter(&buffptr[size], count, from) != count) {
+        if (size == 0) {
+            aesd_entry_free(dev, buffptr, new_size);
+        }
+        else if (buffptr != entry->buffptr) {
+            kfree(buffptr);
+        }
+        mutex_unlock(&file->write_mutex);
+        return -EFAULT;
+    }
+    if (size != 0 && buffptr != entry->buffptr) {
+        memcpy(buffptr, entry->buffptr, size);
+        aesd_entry_free(dev, entry->buffptr, size);
+    }
+    entry->buffptr = buffptr;
+    entry->size = new_size;
+    retval = count;
+    this_cpu_add(dev->stats->bytes_written, retval);
+
+    *f_pos = *f_pos + retval;
+
+    if (memchr(&buffptr[size], '\n', count)) {
+        struct aesd_buffer_entry evicted = {0};
+        // the bytes are already accepted, so the commit cannot be abandoned for a signal
+        aesd_lock_timed(dev, false);
+        if (dev->buffer.full) {
+            evicted = dev->buffer.entry[dev->buffer.out_offs];
+            this_cpu_inc(dev->stats->evictions);
+            trace_aesd_evict(dev, evicted.size, dev->commit_count + 1);
+        }
+        aesd_circular_buffer_add_entry(&dev->buffer, entry);
+        dev->commit_count++;
+        wake_up_interruptible(&dev->read_queue);
+        mutex_unlock(&dev->read_write_mutex);
+        aesd_entry_free(dev, evicted.buffptr, evicted.size);
+        entry->buffptr = NULL;
+        entry->size = 0;
+        committed = true;
+        this_cpu_inc(dev->stats->commands);
+    }
+    else {
+        this_cpu_inc(dev->stats->partial_writes);
+    }
+
+    mutex_unlock(&file->write_mutex);
+    start = ktime_get_ns() - start;
+    this_cpu_inc(dev->stats->write_latency[aesd_latency_bucket(start)]);
+    trace_aesd_write(filp, count, retval, committed, start);
+    return retval;
+}
+
+loff_t aesd_llseek(struct file *filp, loff_t offset, int whence) {
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    loff_t retval = -EINVAL;
+    PDEBUG("Attempting to adjust offset by: %lld", offset);
+
+    mutex_lock(&dev->read_write_mutex);
+    retval = fixed_size_llseek(filp, offset, whence, dev->buffer.total_size);
+    file->read_generation = dev->commit_count;
+    mutex_unlock(&dev->read_write_mutex);
+
+    return retval;
+}
+/**
+ * @return the file position of byte @param offset of command @param cmd, counted from the oldest
+ *   command in the buffer, or -EINVAL if no such command or byte exists.
+ *   Caller holds dev->read_write_mutex.
+ */
+long aesd_adjust_file_offset(struct file *filp, unsigned int cmd, unsigned int offset) {
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    struct aesd_buffer_entry *entry;
+    size_t new_fpos;
+    PDEBUG("cmd: %d offset: %d", cmd, offset);
+    entry = aesd_circular_buffer_find_fpos_for_entry(&dev->buffer, cmd, &new_fpos);
+    if (entry == NULL) {
+        return -EINVAL;
+    }
+    else if (entry->size < offset) {
+        return -EINVAL;
+    }
+    return new_fpos + offset;
+}
+
+/**
+ * Initializes the locks, wait queue and statistics of a zeroed @param dev
+ * @return 0 on success, -ENOMEM on failure
+ */
+int aesd_init_device(struct aesd_dev *dev)
+{
+    dev->stats = alloc_percpu(struct aesd_stats);
+    if (dev->stats == NULL) {
+        return -ENOMEM;
+    }
+    mutex_init(&dev->read_write_mutex);
+    spin_lock_init(&dev->pool_lock);
+    init_waitqueue_head(&dev->read_queue);
+    return 0;
+}
+
+/**
+ * Frees the entries held by @param dev and the chunks cached for reuse
+ */
+void aesd_cleanup_device(struct aesd_dev *dev)
+{
+    struct aesd_buffer_entry *entry;
+    int index;
+
+    AESD_CIRCULAR_BUFFER_FOREACH(entry, &dev->buffer, index) {
+        aesd_entry_free(dev, entry->buffptr, entry->size);
+    }
+    aesd_entry_free(dev, dev->entry.buffptr, dev->entry.size);
+    while (dev->free_count > 0) {
+        kmem_cache_free(aesd_entry_cache, dev->free_chunks[--dev->free_count]);
+    }
+    free_percpu(dev->stats);
+    mutex_destroy(&dev->read_write_mutex);
+}
+
+/**
+ * Initializes the per open state @param file of a reader or writer of @param dev
+ */
+void aesd_init_file(struct aesd_file *file, struct aesd_dev *dev)
+{
+    memset(file, 0, sizeof(struct aesd_file));
+    file->dev = dev;
+    file->read_generation = READ_ONCE(dev->commit_count);
+    mutex_init(&file->write_mutex);
+}
+
+/**
+ * Releases the per open state @param file.  An unterminated command is handed to the
+ * device, appended to any left by earlier writers, for the next writer to continue.
+ * If there is no memory to append it, the fragment is dropped with a warning and the
+ * earlier writers' command is kept.
+ */
+void aesd_cleanup_file(struct aesd_file *file)
+{
+    struct aesd_dev *dev = file->dev;
+    struct aesd_buffer_entry *entry = &file->entry;
+
+    if (entry->size != 0) {
+        mutex_lock(&dev->read_write_mutex);
+        if (dev->entry.size == 0) {
+            dev->entry = *entry;
+        }
+        else {
+            char *merged = aesd_entry_alloc(dev, dev->entry.size + entry->size);
+            if (merged != NULL) {
+                memcpy(merged, dev->entry.buffptr, dev->entry.size);
+                memcpy(merged + dev->entry.size, entry->buffptr, entry->size);
+                aesd_entry_free(dev, dev->entry.buffptr, dev->entry.size);
+                dev->entry.buffptr = merged;
+                dev->entry.size += entry->size;
+            }
+            else {
+                // the earlier writers' bytes stay pending, only this file's fragment is lost
+                pr_warn("aesdchar: dropping %zu unterminated bytes at close, out of memory\n",
+                        entry->size);
+            }
+            aesd_entry_free(dev, entry->buffptr, entry->size);
+        }
+        mutex_unlock(&dev->read_write_mutex);
+    }
+    mutex_destroy(&file->write_mutex);
+}
@@ -0,0 +1,115 @@
+/**
+ * @file aesdchar-snapshot.c
+ * @brief Saves the commands stored on an aesdchar device to an image file and restores them,
+ * so a module reload can resume with the previous contents.
+ *
+ * Usage: aesdchar-snapshot save|restore <device> <image file>
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "aesd_ioctl.h"
+
+static int save(int device_fd, const char *image_path)
+{
+    struct aesd_image image;
+    char *buf = NULL;
+    FILE *out;
+    int rc;
+
+    // the first call reports the image length, retry if commands arrive in between
+    memset(&image, 0, sizeof(image));
+    while ((rc = ioctl(device_fd, AESDCHAR_IOCSNAPSHOT, &image)) != 0 && errno == ENOSPC) {
+        free(buf);
+        buf = malloc(image.buf_len);
+        if (buf == NULL) {
+            perror("malloc");
+            return -1;
+        }
+        image.buf = (uintptr_t)buf;
+    }
+    if (rc != 0) {
+        perror("AESDCHAR_IOCSNAPSHOT");
+        free(buf);
+        return -1;
+    }
+    out = fopen(image_path, "w");
+    if (out == NULL) {
+        perror(image_path);
+        free(buf);
+        return -1;
+    }
+    rc = fwrite(buf, 1, image.buf_len, out) == image.buf_len ? 0 : -1;
+    if (fclose(out) != 0 || rc != 0) {
+        perror(image_path);
+        rc = -1;
+    }
+    free(buf);
+    return rc;
+}
+
+static int restore(int device_fd, const char *image_path)
+{
+    struct aesd_image image;
+    struct stat st;
+    char *buf;
+    int fd;
+    int rc = -1;
+
+    fd = open(image_path, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) != 0) {
+        perror(image_path);
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    buf = malloc(st.st_size);
+    if (buf == NULL) {
+        perror("malloc");
+    }
+    else if (read(fd, buf, st.st_size) != st.st_size) {
+        perror(image_path);
+    }
+    else {
+        image.buf = (uintptr_t)buf;
+        image.buf_len = st.st_size;
+        rc = ioctl(device_fd, AESDCHAR_IOCRESTORE, &image);
+        if (rc != 0) {
+            perror("AESDCHAR_IOCRESTORE");
+        }
+    }
+    free(buf);
+    close(fd);
+    return rc;
+}
+
+int main(int argc, char **argv)
+{
+    int device_fd;
+    int rc;
+
+    if (argc != 4 || (strcmp(argv[1], "save") != 0 && strcmp(argv[1], "restore") != 0)) {
+        fprintf(stderr, "Usage: %s save|restore <device> <image file>\n", argv[0]);
+        return 1;
+    }
+    device_fd = open(argv[2], O_RDWR);
+    if (device_fd == -1) {
+        perror(argv[2]);
+        return 1;
+    }
+    if (strcmp(argv[1], "save") == 0) {
+        rc = save(device_fd, argv[3]);
+    }
+    else {
+        rc = restore(device_fd, argv[3]);
+    }
+    close(device_fd);
+    return rc == 0 ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+/*
+ * aesdchar-trace.h
+ *
+ * Static tracepoints of the AESD char driver, under events/aesdchar/ in tracefs, for
+ * breaking a slow request down with perf or bpftrace:
+ *   perf record -e 'aesdchar:*' -a
+ *   bpftrace -e 'tracepoint:aesdchar:aesd_write { @ns = hist(args->ns); }'
+ * A disabled tracepoint costs a patched out jump.  filp identifies the open file, which
+ * aesdsocket holds for one connection.  User space builds of aesdchar-core.c get empty
+ * stand-ins from aesdchar-user.h.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM aesdchar
+
+#if !defined(_AESDCHAR_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _AESDCHAR_TRACE_H
+
+#include <linux/fs.h>
+#include <linux/tracepoint.h>
+
+/**
+ * A read of @param count bytes at @param pos which returned @param retval after
+ * @param ns, including the wait for read_write_mutex but not for new commands
+ */
+TRACE_EVENT(aesd_read,
+    TP_PROTO(const struct file *filp, loff_t pos, size_t count, ssize_t retval, u64 ns),
+    TP_ARGS(filp, pos, count, retval, ns),
+    TP_STRUCT__entry(
+        __field(const void *, filp)
+        __field(loff_t, pos)
+        __field(size_t, count)
+        __field(ssize_t, retval)
+        __field(u64, ns)
+    ),
+    TP_fast_assign(
+        __entry->filp = filp;
+        __entry->pos = pos;
+        __entry->count = count;
+        __entry->retval = retval;
+        __entry->ns = ns;
+    ),
+    TP_printk("filp=%p pos=%lld count=%zu retval=%zd ns=%llu", __entry->filp, __entry->pos,
+              __entry->count, __entry->retval, __entry->ns)
+);
+
+/**
+ * A write of @param count bytes which returned @param retval after @param ns, and
+ * whether it completed a command
+ */
+TRACE_EVENT(aesd_write,
+    TP_PROTO(const struct file *filp, size_t count, ssize_t retval, bool committed, u64 ns),
+    TP_ARGS(filp, count, retval, committed, ns),
+    TP_STRUCT__entry(
+        __field(const void *, filp)
+        __field(size_t, count)
+        __field(ssize_t, retval)
+        __field(bool, committed)
+        __field(u64, ns)
+    ),
+    TP_fast_assign(
+        __entry->filp = filp;
+        __entry->count = count;
+        __entry->retval = retval;
+        __entry->committed = committed;
+        __entry->ns = ns;
+    ),
+    TP_printk("filp=%p count=%zu retval=%zd committed=%d ns=%llu", __entry->filp, __entry->count,
+              __entry->retval, __entry->committed, __entry->ns)
+);
+
+/**
+ * The oldest command, @param size bytes, overwritten by command number @param commit_count
+ */
+TRACE_EVENT(aesd_evict,
+    TP_PROTO(const void *dev, size_t size, u64 commit_count),
+    TP_ARGS(dev, size, commit_count),
+    TP_STRUCT__entry(
+        __field(const void *, dev)
+        __field(size_t, size)
+        __field(u64, commit_count)
+    ),
+    TP_fast_assign(
+        __entry->dev = dev;
+        __entry->size = size;
+        __entry->commit_count = commit_count;
+    ),
+    TP_printk("dev=%p size=%zu commit_count=%llu", __entry->dev, __entry->size,
+              __entry->commit_count)
+);
+
+/**
+ * An AESDCHAR_IOCSEEKTO to byte @param write_cmd_offset of command @param write_cmd,
+ * returning the new file position or a negative errno value in @param retval
+ */
+TRACE_EVENT(aesd_seekto,
+    TP_PROTO(const struct file *filp, u32 write_cmd, u32 write_cmd_offset, long retval),
+    TP_ARGS(filp, write_cmd, write_cmd_offset, retval),
+    TP_STRUCT__entry(
+        __field(const void *, filp)
+        __field(u32, write_cmd)
+        __field(u32, write_cmd_offset)
+        __field(long, retval)
+    ),
+    TP_fast_assign(
+        __entry->filp = filp;
+        __entry->write_cmd = write_cmd;
+        __entry->write_cmd_offset = write_cmd_offset;
+        __entry->retval = retval;
+    ),
+    TP_printk("filp=%p write_cmd=%u write_cmd_offset=%u retval=%ld", __entry->filp,
+              __entry->write_cmd, __entry->write_cmd_offset, __entry->retval)
+);
+
+#endif /* _AESDCHAR_TRACE_H */
+
+/* Out of tree, so define_trace.h must be told where to find this header again */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE aesdchar-trace
+#include <trace/define_trace.h>
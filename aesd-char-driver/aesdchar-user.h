@@ -0,0 +1,301 @@
+/*
+ * aesdchar-user.h
+ *
+ * User space stand-ins for the kernel interfaces used by aesdchar-core.c, so the
+ * driver's read, write and seek logic can be built and benchmarked as a normal
+ * program.  Only included when __KERNEL__ is not defined.
+ */
+
+#ifndef AESD_CHAR_DRIVER_AESDCHAR_USER_H_
+#define AESD_CHAR_DRIVER_AESDCHAR_USER_H_
+
+#ifdef __KERNEL__
+#error "aesdchar-user.h is for user space builds only"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define __user
+#define __percpu
+#define GFP_KERNEL 0
+#define ERESTARTSYS 512
+#define IOCB_NOWAIT (1 << 7)
+#ifndef READ
+#define READ 0
+#define WRITE 1
+#endif
+
+#define READ_ONCE(x) (*(const volatile __typeof__(x) *)&(x))
+#define min(x, y) ((x) < (y) ? (x) : (y))
+#define max(x, y) ((x) > (y) ? (x) : (y))
+#define min_t(type, x, y) ((type)(x) < (type)(y) ? (type)(x) : (type)(y))
+#define max_t(type, x, y) ((type)(x) > (type)(y) ? (type)(x) : (type)(y))
+#define ilog2(n) (63 - __builtin_clzll((unsigned long long)(n)))
+
+#define pr_warn(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+
+#define module_param(name, type, perm)
+#define MODULE_PARM_DESC(name, desc)
+
+/**
+ * Allocation calls made through the kmalloc and kmem_cache stand-ins, used by the
+ * benchmark to report allocations per operation
+ */
+extern unsigned long aesd_user_alloc_count;
+
+static inline void *kmalloc(size_t size, int flags)
+{
+    (void)flags;
+    aesd_user_alloc_count++;
+    return malloc(size);
+}
+
+static inline void *kzalloc(size_t size, int flags)
+{
+    (void)flags;
+    aesd_user_alloc_count++;
+    return calloc(1, size);
+}
+
+static inline void *krealloc(const void *ptr, size_t size, int flags)
+{
+    (void)flags;
+    aesd_user_alloc_count++;
+    return realloc((void *)ptr, size);
+}
+
+static inline void kfree(const void *ptr)
+{
+    free((void *)ptr);
+}
+
+struct kmem_cache
+{
+    size_t size;
+};
+
+static inline struct kmem_cache *kmem_cache_create_usercopy(const char *name, unsigned int size,
+        unsigned int align, unsigned int flags, unsigned int useroffset, unsigned int usersize,
+        void (*ctor)(void *))
+{
+    struct kmem_cache *cache = malloc(sizeof(struct kmem_cache));
+    (void)name; (void)align; (void)flags; (void)useroffset; (void)usersize; (void)ctor;
+    if (cache != NULL) {
+        cache->size = size;
+    }
+    return cache;
+}
+#define SLAB_HWCACHE_ALIGN 0
+
+static inline void *kmem_cache_alloc(struct kmem_cache *cache, int flags)
+{
+    (void)flags;
+    aesd_user_alloc_count++;
+    return malloc(cache->size);
+}
+
+static inline void kmem_cache_free(struct kmem_cache *cache, void *ptr)
+{
+    (void)cache;
+    free(ptr);
+}
+
+static inline void kmem_cache_destroy(struct kmem_cache *cache)
+{
+    free(cache);
+}
+
+/* There is a single copy of "per CPU" data in user space, shared by all threads */
+#define alloc_percpu(type) ((type *)calloc(1, sizeof(type)))
+#define free_percpu(ptr) free(ptr)
+#define this_cpu_add(pcp, val) __atomic_fetch_add(&(pcp), (val), __ATOMIC_RELAXED)
+#define this_cpu_inc(pcp) this_cpu_add(pcp, 1)
+
+struct mutex
+{
+    pthread_mutex_t lock;
+};
+#define mutex_init(m) pthread_mutex_init(&(m)->lock, NULL)
+#define mutex_destroy(m) pthread_mutex_destroy(&(m)->lock)
+#define mutex_lock(m) pthread_mutex_lock(&(m)->lock)
+#define mutex_lock_interruptible(m) pthread_mutex_lock(&(m)->lock)
+#define mutex_unlock(m) pthread_mutex_unlock(&(m)->lock)
+
+typedef pthread_mutex_t spinlock_t;
+#define spin_lock_init(l) pthread_mutex_init(l, NULL)
+#define spin_lock(l) pthread_mutex_lock(l)
+#define spin_unlock(l) pthread_mutex_unlock(l)
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} wait_queue_head_t;
+
+static inline void init_waitqueue_head(wait_queue_head_t *wq)
+{
+    pthread_mutex_init(&wq->lock, NULL);
+    pthread_cond_init(&wq->cond, NULL);
+}
+
+static inline void wake_up_interruptible(wait_queue_head_t *wq)
+{
+    pthread_mutex_lock(&wq->lock);
+    pthread_cond_broadcast(&wq->cond);
+    pthread_mutex_unlock(&wq->lock);
+}
+
+/* Never interrupted by signals in user space, so always evaluates to 0 */
+#define wait_event_interruptible(wq, condition) ({          \
+    pthread_mutex_lock(&(wq).lock);                         \
+    while (!(condition)) {                                  \
+        pthread_cond_wait(&(wq).cond, &(wq).lock);          \
+    }                                                       \
+    pthread_mutex_unlock(&(wq).lock);                       \
+    0;                                                      \
+})
+
+static inline u64 ktime_get_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Placeholders for members of struct aesd_dev only used by the kernel module */
+struct cdev
+{
+    int unused;
+};
+struct dentry;
+
+struct file
+{
+    void *private_data;
+    unsigned int f_flags;
+    loff_t f_pos;
+};
+
+struct kiocb
+{
+    struct file *ki_filp;
+    loff_t ki_pos;
+    int ki_flags;
+};
+
+static inline loff_t fixed_size_llseek(struct file *filp, loff_t offset, int whence, loff_t size)
+{
+    switch (whence) {
+        case SEEK_SET:
+            break;
+        case SEEK_CUR:
+            offset += filp->f_pos;
+            break;
+        case SEEK_END:
+            offset += size;
+            break;
+        default:
+            return -EINVAL;
+    }
+    if (offset < 0 || offset > size) {
+        return -EINVAL;
+    }
+    filp->f_pos = offset;
+    return offset;
+}
+
+/**
+ * A user space iov_iter over an array of struct iovec
+ */
+struct iov_iter
+{
+    const struct iovec *iov;
+    unsigned long nr_segs;
+    size_t iov_offset;
+    size_t count;
+};
+
+static inline void iov_iter_init(struct iov_iter *i, unsigned int direction,
+        const struct iovec *iov, unsigned long nr_segs, size_t count)
+{
+    (void)direction;
+    i->iov = iov;
+    i->nr_segs = nr_segs;
+    i->iov_offset = 0;
+    i->count = count;
+}
+
+static inline size_t iov_iter_count(const struct iov_iter *i)
+{
+    return i->count;
+}
+
+/**
+ * Copies @param bytes between @param addr and the segments of @param i, advancing @param i
+ * @param to_iter true to copy from addr into the iterator, false to copy out of it
+ */
+static inline size_t iov_iter_copy(void *addr, size_t bytes, struct iov_iter *i, bool to_iter)
+{
+    size_t copied = 0;
+
+    bytes = min(bytes, i->count);
+    while (copied < bytes) {
+        size_t n = min(bytes - copied, i->iov->iov_len - i->iov_offset);
+        char *seg = (char *)i->iov->iov_base + i->iov_offset;
+        if (to_iter) {
+            memcpy(seg, (char *)addr + copied, n);
+        }
+        else {
+            memcpy((char *)addr + copied, seg, n);
+        }
+        copied += n;
+        i->iov_offset += n;
+        i->count -= n;
+        if (i->iov_offset == i->iov->iov_len) {
+            i->iov++;
+            i->nr_segs--;
+            i->iov_offset = 0;
+        }
+    }
+    return copied;
+}
+
+static inline size_t copy_to_iter(const void *addr, size_t bytes, struct iov_iter *i)
+{
+    return iov_iter_copy((void *)addr, bytes, i, true);
+}
+
+static inline size_t copy_from_iter(void *addr, size_t bytes, struct iov_iter *i)
+{
+    return iov_iter_copy(addr, bytes, i, false);
+}
+
+/* The tracepoints of aesdchar-trace.h, which only exist in the kernel */
+static inline void trace_aesd_read(const struct file *filp, loff_t pos, size_t count, ssize_t retval, u64 ns)
+{
+}
+
+static inline void trace_aesd_write(const struct file *filp, size_t count, ssize_t retval, bool committed, u64 ns)
+{
+}
+
+static inline void trace_aesd_evict(const void *dev, size_t size, u64 commit_count)
+{
+}
+
+#endif /* AESD_CHAR_DRIVER_AESDCHAR_USER_H_ */
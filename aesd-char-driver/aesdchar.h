@@ -8,7 +8,7 @@
 #ifndef AESD_CHAR_DRIVER_AESDCHAR_H_
 #define AESD_CHAR_DRIVER_AESDCHAR_H_
 
-#define AESD_DEBUG 1  //Remove comment on this line to enable debug
+//#define AESD_DEBUG 1  //Remove comment on this line to enable debug, or build with DEBUG=y
 
 #undef PDEBUG             /* undef it, just in case */
 #ifdef AESD_DEBUG
@@ -22,17 +22,106 @@
 #else
 #  define PDEBUG(fmt, args...) /* not debugging: nothing */
 #endif
+#ifndef __KERNEL__
+#include "aesdchar-user.h"
+#endif
 #include "aesd-circular-buffer.h"
+
+#ifndef AESD_NR_DEVS
+#define AESD_NR_DEVS 1    /* default number of aesdchar minors, see aesd_nr_devs */
+#endif
+#define AESD_MAX_DEVS 64
+
+/**
+ * Size of the objects in the aesdchar_entry kmem_cache.  Commands up to this
+ * many bytes are stored in a cache object, longer ones fall back to kmalloc.
+ */
+#define AESD_ENTRY_CHUNK_SIZE 512
+
+/**
+ * Number of buckets in the latency histograms.  Bucket 0 counts operations under 256ns,
+ * bucket n counts [2^(n+7), 2^(n+8)) ns and the last bucket everything slower.
+ */
+#define AESD_LATENCY_BUCKETS 16
+
+/**
+ * Per CPU counters for one device, summed when read through debugfs
+ */
+struct aesd_stats
+{
+    u64 bytes_read;
+    u64 bytes_written;
+    u64 commands;           /* complete commands added to the buffer */
+    u64 evictions;          /* commands overwritten by newer ones */
+    u64 partial_writes;     /* writes which left a command unterminated */
+    u64 lock_acquisitions;  /* timed acquisitions of read_write_mutex */
+    u64 lock_wait_ns;       /* total time spent waiting for them */
+    u64 read_latency[AESD_LATENCY_BUCKETS];
+    u64 write_latency[AESD_LATENCY_BUCKETS];
+};
+
 struct aesd_dev
 {
     /**
-     * TODO: Add structure(s) and locks needed to complete assignment requirements
+     * A command left unterminated by a writer which closed the device, continued by the
+     * next write from any file.  Protected by read_write_mutex.
      */
     struct aesd_buffer_entry entry;
     struct aesd_circular_buffer buffer;
     struct mutex read_write_mutex;
+    /**
+     * Cache objects released by evicted entries, reused for the next command
+     * before going back to the allocator.  Protected by pool_lock.
+     */
+    char *free_chunks[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    unsigned int free_count;
+    spinlock_t pool_lock;
+    /**
+     * Incremented each time a complete command is committed to buffer.
+     * Readers sleeping on read_queue are woken after each increment.
+     */
+    u64 commit_count;
+    wait_queue_head_t read_queue;
+    struct aesd_stats __percpu *stats;
+    struct dentry *debugfs_dir;
     struct cdev cdev;     /* Char device structure      */
 };
 
+/**
+ * Per open file state, stored in filp->private_data
+ */
+struct aesd_file
+{
+    struct aesd_dev *dev;
+    /**
+     * The value of dev->commit_count when this file last reached the end of
+     * the buffer or was repositioned.  Commands committed since then are the
+     * new data for tail reads and poll.
+     */
+    u64 read_generation;
+    /**
+     * The command this file is writing, committed to the device buffer once its
+     * terminating newline arrives.  Protected by write_mutex.
+     */
+    struct aesd_buffer_entry entry;
+    struct mutex write_mutex;
+};
+
+
+/* aesdchar-core.c */
+extern bool tail_reads;
+int aesd_entry_cache_create(void);
+void aesd_entry_cache_destroy(void);
+int aesd_init_device(struct aesd_dev *dev);
+void aesd_cleanup_device(struct aesd_dev *dev);
+void aesd_init_file(struct aesd_file *file, struct aesd_dev *dev);
+void aesd_cleanup_file(struct aesd_file *file);
+int aesd_lock_timed(struct aesd_dev *dev, bool interruptible);
+char *aesd_entry_alloc(struct aesd_dev *dev, size_t size);
+void aesd_entry_free(struct aesd_dev *dev, const char *buffptr, size_t size);
+ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t aesd_write_iter(struct kiocb *iocb, struct iov_iter *from);
+loff_t aesd_llseek(struct file *filp, loff_t offset, int whence);
+long aesd_adjust_file_offset(struct file *filp, unsigned int cmd, unsigned int offset);
 
 #endif /* AESD_CHAR_DRIVER_AESDCHAR_H_ */
\ No newline at end of file
@@ -12,158 +12,266 @@
  */
 
 #include <linux/module.h>
+#include <linux/version.h>
 #include <linux/init.h>
 #include <linux/printk.h>
 #include <linux/types.h>
 #include <linux/cdev.h>
 #include <linux/fs.h>
 #include <linux/slab.h>
+#include <linux/poll.h>
+#include <linux/uio.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include "aesdchar.h"
 #include "aesd_ioctl.h"
+#define CREATE_TRACE_POINTS
+#include "aesdchar-trace.h"
 int aesd_major =   0; 
 int aesd_minor =   0;
+int aesd_nr_devs = AESD_NR_DEVS;
+module_param(aesd_nr_devs, int, S_IRUGO);
+MODULE_PARM_DESC(aesd_nr_devs, "Number of independent /dev/aesdcharN devices");
 
 MODULE_AUTHOR("Peter Correa");
 MODULE_LICENSE("Dual BSD/GPL");
 
-struct aesd_dev aesd_device;
+struct aesd_dev *aesd_devices;  /* aesd_nr_devs devices, one per minor */
+static int aesd_devs_ready;     /* devices with a registered cdev */
+
+static struct dentry *aesd_debugfs_root;
 
 int aesd_open(struct inode *inode, struct file *filp) {
     struct aesd_dev *dev;
+    struct aesd_file *file;
     PDEBUG("open");
     dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
-    filp->private_data = dev;
+    file = kmalloc(sizeof(struct aesd_file), GFP_KERNEL);
+    if (file == NULL) {
+        return -ENOMEM;
+    }
+    aesd_init_file(file, dev);
+    filp->private_data = file;
 
     return 0;
 }
 
 int aesd_release(struct inode *inode, struct file *filp) {
     PDEBUG("release");
-    /**
-     * TODO: handle release
-     */
+    aesd_cleanup_file(filp->private_data);
+    kfree(filp->private_data);
     return 0;
 }
 
-ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
-                loff_t *f_pos) {
-    struct aesd_dev *dev = filp->private_data;
-    struct aesd_buffer_entry *read_buffer;
-    int count_remaining;
-    size_t offset;
-    ssize_t retval = 0;
-    PDEBUG("read %zu bytes with offset %lld",count,*f_pos);
+/**
+ * Fills @param info with the state of the buffer and copies each command's size to the
+ * user array described by info->entry_sizes and info->entry_sizes_len, oldest first.
+ */
+static long aesd_get_info(struct aesd_dev *dev, struct aesd_info *info)
+{
+    u32 sizes[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    struct aesd_buffer_entry *entry;
+    size_t fpos;
+    u32 index;
 
-    //mutex lock
     mutex_lock(&dev->read_write_mutex);
-    read_buffer = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->buffer, *f_pos, &offset);
-    if (read_buffer == NULL) {
-        mutex_unlock(&dev->read_write_mutex);
-        return retval;
-    }
-    retval = (count < (read_buffer->size - offset)) ? count : read_buffer->size - offset;
-    count_remaining = copy_to_user(buf, read_buffer->buffptr + offset, retval);
-    if (count_remaining != 0) {
-        mutex_unlock(&dev->read_write_mutex);
-        return -EFAULT;
+    info->generation = dev->commit_count;
+    info->total_size = dev->buffer.total_size;
+    info->entry_count = aesd_circular_buffer_entry_count(&dev->buffer);
+    for (index = 0; index < info->entry_count; index++) {
+        entry = aesd_circular_buffer_find_fpos_for_entry(&dev->buffer, index, &fpos);
+        sizes[index] = entry->size;
     }
-   
-    *f_pos = *f_pos + retval;
-    
     mutex_unlock(&dev->read_write_mutex);
-    return retval;
+
+    info->entry_sizes_len = min(info->entry_sizes_len, info->entry_count);
+    if (info->entry_sizes_len > 0 &&
+            copy_to_user(u64_to_user_ptr(info->entry_sizes), sizes,
+                         info->entry_sizes_len * sizeof(sizes[0])) != 0) {
+        return -EFAULT;
+    }
+    return 0;
 }
 
-ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
-                loff_t *f_pos)
+/**
+ * Serializes the commands stored in @param dev to the user buffer described by @param image,
+ * in the format described by struct aesd_image_header.  image->buf_len is set to the length
+ * of the image, and -ENOSPC returned without copying anything if the buffer is too small.
+ */
+static long aesd_snapshot(struct aesd_dev *dev, struct aesd_image *image)
 {
-    ssize_t retval = -ENOMEM;
-    struct aesd_dev *dev = filp->private_data;
-    size_t size = dev->entry.size;
-    ssize_t count_remaining;
-    PDEBUG("write %zu bytes with offset %lld",count,*f_pos);
-    /**
-     * TODO: handle write
-     */
-    //mutex
+    struct aesd_image_header header;
+    struct aesd_buffer_entry *entry;
+    char __user *dst = u64_to_user_ptr(image->buf);
+    size_t fpos;
+    u32 index;
+    u32 size;
+    u64 len;
+    long retval = 0;
+
     mutex_lock(&dev->read_write_mutex);
-    if (size == 0) {
-        dev->entry.buffptr = kzalloc(count, GFP_KERNEL);
-    }
-    else {
-        int new_size = size + count;
-        dev->entry.buffptr = krealloc(dev->entry.buffptr, new_size, GFP_KERNEL);
+    header.magic = AESD_IMAGE_MAGIC;
+    header.version = AESD_IMAGE_VERSION;
+    header.entry_count = aesd_circular_buffer_entry_count(&dev->buffer);
+    header.total_size = dev->buffer.total_size;
+    header.generation = dev->commit_count;
+    len = sizeof(header) + header.entry_count * sizeof(size) + header.total_size;
+    if (image->buf_len < len) {
+        retval = -ENOSPC;
     }
-    if (dev->entry.buffptr == NULL) {
-        mutex_unlock(&dev->read_write_mutex);
-        return retval;
+    else if (copy_to_user(dst, &header, sizeof(header)) != 0) {
+        retval = -EFAULT;
     }
-
-    count_remaining = copy_from_user((void*)&dev->entry.buffptr[size], buf, count);
-    retval = count - count_remaining;
-    dev->entry.size = size + retval;
-
-    *f_pos = *f_pos + retval;
-
-    if (strchr((char*)dev->entry.buffptr, '\n')) {
-        const char* buffptr_to_free = aesd_circular_buffer_add_entry(&dev->buffer,&dev->entry);
-        kfree(buffptr_to_free);
-        dev->entry.buffptr = NULL;
-        dev->entry.size = 0;
+    dst += sizeof(header);
+    for (index = 0; retval == 0 && index < header.entry_count; index++) {
+        entry = aesd_circular_buffer_find_fpos_for_entry(&dev->buffer, index, &fpos);
+        size = entry->size;
+        if (copy_to_user(dst, &size, sizeof(size)) != 0 ||
+                copy_to_user(dst + sizeof(size), entry->buffptr, size) != 0) {
+            retval = -EFAULT;
+        }
+        dst += sizeof(size) + size;
     }
-
     mutex_unlock(&dev->read_write_mutex);
+    image->buf_len = len;
     return retval;
 }
 
-loff_t aesd_llseek(struct file *filp, loff_t offset, int whence) {
-    struct aesd_dev *dev = filp->private_data;
-    loff_t retval = -EINVAL;
-    PDEBUG("Attempting to adjust offset by: %lld", offset);
-
-    mutex_lock(&dev->read_write_mutex);
-    retval = fixed_size_llseek(filp, offset, whence, dev->buffer.total_size);
-    mutex_unlock(&dev->read_write_mutex);
+/**
+ * Replaces the commands stored in @param dev with those in the image produced by aesd_snapshot,
+ * found in the user buffer described by @param image.  All entries are allocated and copied
+ * before the buffer is touched, so on error the previous contents are kept.
+ */
+static long aesd_restore(struct aesd_dev *dev, const struct aesd_image *image)
+{
+    struct aesd_image_header header;
+    struct aesd_buffer_entry staged[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    struct aesd_buffer_entry *entry;
+    const char __user *src = u64_to_user_ptr(image->buf);
+    u64 remaining = image->buf_len;
+    u32 count;
+    u32 index;
+    int entry_index;
+    long retval = 0;
 
-    return retval;
-}
-long aesd_adjust_file_offset(struct file *filp, unsigned int cmd, unsigned int offset) {
-    struct aesd_dev *dev = filp->private_data;
-    int proposed_cmd = (dev->buffer.out_offs + cmd) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-    int new_fpos = 0;
-    PDEBUG("cmd: %d offset: %d", cmd, offset);
-    PDEBUG("current buffer: %d proposed buffer: %d", dev->buffer.out_offs, proposed_cmd);
-    if (cmd > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) {
+    if (remaining < sizeof(header)) {
         return -EINVAL;
     }
-    else if (dev->buffer.entry[proposed_cmd].buffptr == NULL) {
-        return -EINVAL;
+    if (copy_from_user(&header, src, sizeof(header)) != 0) {
+        return -EFAULT;
     }
-    else if (dev->buffer.entry[proposed_cmd].size < offset) {
+    if (header.magic != AESD_IMAGE_MAGIC || header.version != AESD_IMAGE_VERSION ||
+            header.entry_count > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) {
         return -EINVAL;
     }
+    src += sizeof(header);
+    remaining -= sizeof(header);
+
+    mutex_lock(&dev->read_write_mutex);
+    for (count = 0; count < header.entry_count; count++) {
+        u32 size;
+        if (remaining < sizeof(size)) {
+            retval = -EINVAL;
+            break;
+        }
+        if (copy_from_user(&size, src, sizeof(size)) != 0) {
+            retval = -EFAULT;
+            break;
+        }
+        src += sizeof(size);
+        remaining -= sizeof(size);
+        if (size == 0 || size > remaining) {
+            retval = -EINVAL;
+            break;
+        }
+        staged[count].buffptr = aesd_entry_alloc(dev, size);
+        if (staged[count].buffptr == NULL) {
+            retval = -ENOMEM;
+            break;
+        }
+        staged[count].size = size;
+        if (copy_from_user((char *)staged[count].buffptr, src, size) != 0) {
+            count++;
+            retval = -EFAULT;
+            break;
+        }
+        src += size;
+        remaining -= size;
+    }
+    if (retval == 0) {
+        AESD_CIRCULAR_BUFFER_FOREACH(entry, &dev->buffer, entry_index) {
+            aesd_entry_free(dev, entry->buffptr, entry->size);
+        }
+        aesd_circular_buffer_init(&dev->buffer);
+        for (index = 0; index < count; index++) {
+            aesd_circular_buffer_add_entry(&dev->buffer, &staged[index]);
+        }
+        // keep generations increasing so clients notice the new contents
+        dev->commit_count = max_t(u64, dev->commit_count + count, header.generation);
+        wake_up_interruptible(&dev->read_queue);
+    }
     else {
-        int index;
-        for (index = 0; index < cmd; index++) { 
-            int entry_index = (index + dev->buffer.out_offs) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-            new_fpos += dev->buffer.entry[entry_index].size;
+        for (index = 0; index < count; index++) {
+            aesd_entry_free(dev, staged[index].buffptr, staged[index].size);
         }
-        new_fpos += offset;
     }
-    return new_fpos;
+    mutex_unlock(&dev->read_write_mutex);
+    return retval;
 }
+
 long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
-    long retval = 0;
+    struct aesd_file *file = filp->private_data;
+    long retval = -ENOTTY;
     struct aesd_seekto seekto;
+    struct aesd_info info;
+    struct aesd_image image;
 
     switch(cmd) {
         case AESDCHAR_IOCSEEKTO:
             if (copy_from_user(&seekto, (const void __user *)arg, sizeof(seekto)) != 0) {
-                retval = EFAULT;
+                retval = -EFAULT;
             }
             else {
+                mutex_lock(&file->dev->read_write_mutex);
                 retval = aesd_adjust_file_offset(filp,seekto.write_cmd, seekto.write_cmd_offset);
-                filp->f_pos = retval;
+                if (retval >= 0) {
+                    filp->f_pos = retval;
+                    file->read_generation = file->dev->commit_count;
+                }
+                mutex_unlock(&file->dev->read_write_mutex);
+                trace_aesd_seekto(filp, seekto.write_cmd, seekto.write_cmd_offset, retval);
+            }
+            break;
+        case AESDCHAR_IOCINFO:
+            if (copy_from_user(&info, (const void __user *)arg, sizeof(info)) != 0) {
+                retval = -EFAULT;
+            }
+            else {
+                retval = aesd_get_info(file->dev, &info);
+                if (retval == 0 && copy_to_user((void __user *)arg, &info, sizeof(info)) != 0) {
+                    retval = -EFAULT;
+                }
+            }
+            break;
+        case AESDCHAR_IOCSNAPSHOT:
+            if (copy_from_user(&image, (const void __user *)arg, sizeof(image)) != 0) {
+                retval = -EFAULT;
+            }
+            else {
+                retval = aesd_snapshot(file->dev, &image);
+                // the required length is reported back with -ENOSPC too
+                if (copy_to_user((void __user *)arg, &image, sizeof(image)) != 0) {
+                    retval = -EFAULT;
+                }
+            }
+            break;
+        case AESDCHAR_IOCRESTORE:
+            if (copy_from_user(&image, (const void __user *)arg, sizeof(image)) != 0) {
+                retval = -EFAULT;
+            }
+            else {
+                retval = aesd_restore(file->dev, &image);
             }
             break;
         default:
@@ -172,73 +280,178 @@ long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
 
     return retval;
 }
+__poll_t aesd_poll(struct file *filp, poll_table *wait) {
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+    poll_wait(filp, &dev->read_queue, wait);
+    mutex_lock(&dev->read_write_mutex);
+    if (filp->f_pos < dev->buffer.total_size ||
+            (tail_reads && file->read_generation != dev->commit_count)) {
+        mask |= EPOLLIN | EPOLLRDNORM;
+    }
+    mutex_unlock(&dev->read_write_mutex);
+    return mask;
+}
+
 struct file_operations aesd_fops = {
     .owner =    THIS_MODULE,
-    .read =     aesd_read,
-    .write =    aesd_write,
+    .read_iter = aesd_read_iter,
+    .write_iter = aesd_write_iter,
     .open =     aesd_open,
     .release =  aesd_release,
     .llseek  = aesd_llseek,
     .unlocked_ioctl = aesd_ioctl,
+    .poll =     aesd_poll,
+    /**
+     * splice_read (and so sendfile) fills the pipe through aesd_read_iter, letting a server
+     * move commands to a socket without copying them through user space.  Entries live in
+     * slab memory freed on eviction, so pages cannot be lent to the pipe directly.
+     */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    .splice_read = copy_splice_read,
+#else
+    .splice_read = generic_file_splice_read,
+#endif
 };
 
-static int aesd_setup_cdev(struct aesd_dev *dev)
+static void aesd_stats_show_histogram(struct seq_file *s, const char *name, const u64 *buckets)
+{
+    unsigned int i;
+
+    seq_printf(s, "%s:\n", name);
+    seq_printf(s, "  [0, 256): %llu\n", buckets[0]);
+    for (i = 1; i < AESD_LATENCY_BUCKETS - 1; i++) {
+        seq_printf(s, "  [%llu, %llu): %llu\n", 1ULL << (i + 7), 1ULL << (i + 8), buckets[i]);
+    }
+    seq_printf(s, "  [%llu, inf): %llu\n", 1ULL << (i + 7), buckets[i]);
+}
+
+/**
+ * debugfs aesdcharN/stats, the sum of the per CPU counters of one device
+ */
+static int aesd_stats_show(struct seq_file *s, void *unused)
+{
+    struct aesd_dev *dev = s->private;
+    struct aesd_stats sum;
+    int cpu;
+    unsigned int i;
+
+    memset(&sum, 0, sizeof(sum));
+    for_each_possible_cpu(cpu) {
+        const struct aesd_stats *stats = per_cpu_ptr(dev->stats, cpu);
+        sum.bytes_read += stats->bytes_read;
+        sum.bytes_written += stats->bytes_written;
+        sum.commands += stats->commands;
+        sum.evictions += stats->evictions;
+        sum.partial_writes += stats->partial_writes;
+        sum.lock_acquisitions += stats->lock_acquisitions;
+        sum.lock_wait_ns += stats->lock_wait_ns;
+        for (i = 0; i < AESD_LATENCY_BUCKETS; i++) {
+            sum.read_latency[i] += stats->read_latency[i];
+            sum.write_latency[i] += stats->write_latency[i];
+        }
+    }
+    seq_printf(s, "bytes_read: %llu\n", sum.bytes_read);
+    seq_printf(s, "bytes_written: %llu\n", sum.bytes_written);
+    seq_printf(s, "commands: %llu\n", sum.commands);
+    seq_printf(s, "evictions: %llu\n", sum.evictions);
+    seq_printf(s, "partial_writes: %llu\n", sum.partial_writes);
+    seq_printf(s, "lock_acquisitions: %llu\n", sum.lock_acquisitions);
+    seq_printf(s, "lock_wait_ns: %llu\n", sum.lock_wait_ns);
+    aesd_stats_show_histogram(s, "read_latency_ns", sum.read_latency);
+    aesd_stats_show_histogram(s, "write_latency_ns", sum.write_latency);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(aesd_stats);
+
+static int aesd_setup_cdev(struct aesd_dev *dev, int index)
 {
-    int err, devno = MKDEV(aesd_major, aesd_minor);
+    int err, devno = MKDEV(aesd_major, aesd_minor + index);
 
     cdev_init(&dev->cdev, &aesd_fops);
     dev->cdev.owner = THIS_MODULE;
     dev->cdev.ops = &aesd_fops;
     err = cdev_add (&dev->cdev, devno, 1);
     if (err) {
-        printk(KERN_ERR "Error %d adding aesd cdev", err);
+        printk(KERN_ERR "Error %d adding aesd%d cdev", err, index);
     }
     return err;
 }
 
+void aesd_cleanup_module(void)
+{
+    dev_t devno = MKDEV(aesd_major, aesd_minor);
+    int i;
+
+    /**
+     * Also used to unwind a partially completed aesd_init_module, so only the
+     * aesd_devs_ready devices which were fully set up are torn down
+     */
+    debugfs_remove_recursive(aesd_debugfs_root);
+    aesd_debugfs_root = NULL;
+    if (aesd_devices != NULL) {
+        for (i = 0; i < aesd_devs_ready; i++) {
+            cdev_del(&aesd_devices[i].cdev);
+            aesd_cleanup_device(&aesd_devices[i]);
+        }
+        kfree(aesd_devices);
+        aesd_devices = NULL;
+    }
+    aesd_devs_ready = 0;
+    aesd_entry_cache_destroy();
+    unregister_chrdev_region(devno, aesd_nr_devs);
+}
+
 int aesd_init_module(void)
 {
     dev_t dev = 0;
     int result;
-    result = alloc_chrdev_region(&dev, aesd_minor, 1,
+    int i;
+
+    if (aesd_nr_devs < 1 || aesd_nr_devs > AESD_MAX_DEVS) {
+        printk(KERN_WARNING "aesd_nr_devs must be between 1 and %d\n", AESD_MAX_DEVS);
+        return -EINVAL;
+    }
+    result = alloc_chrdev_region(&dev, aesd_minor, aesd_nr_devs,
             "aesdchar");
     aesd_major = MAJOR(dev);
     if (result < 0) {
         printk(KERN_WARNING "Can't get major %d\n", aesd_major);
         return result;
     }
-    memset(&aesd_device,0,sizeof(struct aesd_dev));
-
-    /**
-     * TODO: initialize the AESD specific portion of the device
-     */
-    mutex_init(&aesd_device.read_write_mutex);
-    result = aesd_setup_cdev(&aesd_device);
 
-    if( result ) {
-        unregister_chrdev_region(dev, 1);
+    aesd_devices = kcalloc(aesd_nr_devs, sizeof(struct aesd_dev), GFP_KERNEL);
+    if (aesd_entry_cache_create() != 0 || aesd_devices == NULL) {
+        result = -ENOMEM;
+        goto fail;
     }
-    return result;
-
-}
-
-void aesd_cleanup_module(void)
-{
-    dev_t devno = MKDEV(aesd_major, aesd_minor);
-    struct aesd_buffer_entry *entry;
-    int index;
-    cdev_del(&aesd_device.cdev);
 
-    /**
-     * TODO: cleanup AESD specific poritions here as necessary
-     */
-    AESD_CIRCULAR_BUFFER_FOREACH(entry, &aesd_device.buffer, index) {
-        kfree(entry->buffptr);
+    aesd_debugfs_root = debugfs_create_dir("aesdchar", NULL);
+    for (i = 0; i < aesd_nr_devs; i++) {
+        struct aesd_dev *aesd_device = &aesd_devices[i];
+        char name[16];
+        result = aesd_init_device(aesd_device);
+        if (result) {
+            goto fail;
+        }
+        result = aesd_setup_cdev(aesd_device, i);
+        if (result) {
+            aesd_cleanup_device(aesd_device);
+            goto fail;
+        }
+        aesd_devs_ready++;
+        snprintf(name, sizeof(name), "aesdchar%d", i);
+        aesd_device->debugfs_dir = debugfs_create_dir(name, aesd_debugfs_root);
+        debugfs_create_file("stats", 0444, aesd_device->debugfs_dir, aesd_device, &aesd_stats_fops);
     }
-    kfree(aesd_device.entry.buffptr);
-    mutex_destroy(&aesd_device.read_write_mutex);
-    unregister_chrdev_region(devno, 1);
+    return 0;
+
+fail:
+    aesd_cleanup_module();
+    return result;
 }
 
 module_init(aesd_init_module);
-module_exit(aesd_cleanup_module);
\ No newline at end of file
+module_exit(aesd_cleanup_module);
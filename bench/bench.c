@@ -0,0 +1,214 @@
+/**
+ * @file bench.c
+ * @brief Option parsing, timing and baseline comparison shared by the benchmarks
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "bench.h"
+
+#define BENCH_MAX_RESULTS 128
+#define BENCH_NAME_LEN 64
+#define BENCH_UNIT_LEN 16
+#define BENCH_DEFAULT_TOLERANCE 50.0
+#define BENCH_DEFAULT_NOISE 5.0
+
+struct bench_result
+{
+    char name[BENCH_NAME_LEN];
+    char unit[BENCH_UNIT_LEN];
+    double value;
+};
+
+static struct bench_result baseline[BENCH_MAX_RESULTS];
+static int baseline_count;
+static struct bench_result results[BENCH_MAX_RESULTS];
+static int result_count;
+static const char *record_path;
+static double tolerance = BENCH_DEFAULT_TOLERANCE;
+static double noise = BENCH_DEFAULT_NOISE;
+static double scale = 1.0;
+static int regressions;
+static FILE *out;
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [--baseline file] [--record file] [--tolerance pct] [--noise value]\n"
+            "       [--scale factor]\n",
+            prog);
+}
+
+/**
+ * Reads "<name> <value> <unit>" lines from @param path, skipping blank and # lines.
+ * A missing file is not an error: the results of this run are recorded to it instead,
+ * unless --record names another file.
+ */
+static int load_baseline(const char *path)
+{
+    char line[256];
+    FILE *in = fopen(path, "r");
+
+    if (in == NULL && errno == ENOENT) {
+        fprintf(stderr, "No baseline at %s, recording this run as the baseline\n", path);
+        if (record_path == NULL) {
+            record_path = path;
+        }
+        return 0;
+    }
+    if (in == NULL) {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), in) != NULL && baseline_count < BENCH_MAX_RESULTS) {
+        struct bench_result *b = &baseline[baseline_count];
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        if (sscanf(line, "%63s %lf %15s", b->name, &b->value, b->unit) == 3) {
+            baseline_count++;
+        }
+    }
+    fclose(in);
+    return 0;
+}
+
+int bench_init(int argc, char **argv)
+{
+    int devnull;
+    int fd;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return -1;
+        }
+        if (strcmp(argv[i], "--baseline") == 0) {
+            if (load_baseline(argv[++i]) != 0) {
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--record") == 0) {
+            record_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--tolerance") == 0) {
+            tolerance = strtod(argv[++i], NULL);
+        }
+        else if (strcmp(argv[i], "--noise") == 0) {
+            noise = strtod(argv[++i], NULL);
+        }
+        else if (strcmp(argv[i], "--scale") == 0) {
+            scale = strtod(argv[++i], NULL);
+        }
+        else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (scale <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    // keep results on the real stdout and send anything the workloads print to /dev/null
+    fflush(stdout);
+    fd = dup(STDOUT_FILENO);
+    devnull = open("/dev/null", O_WRONLY);
+    if (fd == -1 || devnull == -1 || (out = fdopen(fd, "w")) == NULL
+            || dup2(devnull, STDOUT_FILENO) == -1) {
+        perror("bench_init");
+        return -1;
+    }
+    close(devnull);
+    setvbuf(out, NULL, _IOLBF, 0);
+    return 0;
+}
+
+uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+double bench_measure_ns(bench_fn fn, void *arg, unsigned long iterations, int repeats)
+{
+    double samples[repeats];
+    unsigned long i;
+    int r;
+
+    iterations = (unsigned long)(iterations * scale);
+    if (iterations == 0) {
+        iterations = 1;
+    }
+    for (r = 0; r < repeats; r++) {
+        uint64_t start = bench_now_ns();
+        for (i = 0; i < iterations; i++) {
+            fn(arg, i);
+        }
+        samples[r] = (double)(bench_now_ns() - start) / iterations;
+    }
+    qsort(samples, repeats, sizeof(double), compare_double);
+    return samples[repeats / 2];
+}
+
+void bench_report(const char *name, double value, const char *unit)
+{
+    const char *verdict = "";
+    int i;
+
+    if (result_count < BENCH_MAX_RESULTS) {
+        struct bench_result *r = &results[result_count++];
+        snprintf(r->name, sizeof(r->name), "%s", name);
+        snprintf(r->unit, sizeof(r->unit), "%s", unit);
+        r->value = value;
+    }
+    for (i = 0; i < baseline_count; i++) {
+        if (strcmp(baseline[i].name, name) == 0) {
+            if (value > baseline[i].value * (1.0 + tolerance / 100.0)
+                    && value - baseline[i].value > noise) {
+                verdict = "  REGRESSION";
+                regressions++;
+            }
+            fprintf(out, "%-32s %12.1f %-8s baseline %12.1f %+6.0f%%%s\n", name, value, unit,
+                    baseline[i].value, (value / baseline[i].value - 1.0) * 100.0, verdict);
+            return;
+        }
+    }
+    fprintf(out, "%-32s %12.1f %s\n", name, value, unit);
+}
+
+int bench_finish(void)
+{
+    FILE *rec;
+    int i;
+
+    if (record_path != NULL) {
+        rec = fopen(record_path, "w");
+        if (rec == NULL) {
+            perror(record_path);
+            return 1;
+        }
+        fprintf(rec, "# <name> <value> <unit>, lower is better\n");
+        for (i = 0; i < result_count; i++) {
+            fprintf(rec, "%s %.1f %s\n", results[i].name, results[i].value, results[i].unit);
+        }
+        fclose(rec);
+    }
+    if (regressions > 0) {
+        fprintf(out, "%d result(s) more than %.0f%% slower than the baseline\n", regressions, tolerance);
+    }
+    fclose(out);
+    return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * bench.h
+ *
+ * Shared reporting for the benchmark executables.  Each result is printed as one
+ * "<name> <value> <unit>" line, where lower values are better, and can be compared
+ * against a baseline file in the same format so a slowdown beyond the tolerance fails
+ * the run.
+ *
+ * Every benchmark accepts:
+ *   --baseline <file>   compare results against file, exit status 1 on a regression; a
+ *                       missing file is created from this run's results
+ *   --record <file>     write the results to file, to create or refresh a baseline
+ *   --tolerance <pct>   allowed slowdown over the baseline in percent, default 50
+ *   --noise <value>     slowdowns smaller than this many units never fail, default 5, so
+ *                       results of a few nanoseconds do not fail on timer jitter
+ *   --scale <factor>    multiply iteration counts, for quicker or steadier runs
+ */
+
+#ifndef BENCH_BENCH_H
+#define BENCH_BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef void (*bench_fn)(void *arg, unsigned long iteration);
+
+/**
+ * Parses the common options.  Workload output written to stdout after this call is
+ * discarded, so only result lines reach the original stdout.
+ * @return 0 on success, -1 after printing usage on bad arguments
+ */
+int bench_init(int argc, char **argv);
+
+/**
+ * @return the median over @param repeats runs of the time per call of @param fn, in
+ * nanoseconds, calling it @param iterations times (times --scale) per run
+ */
+double bench_measure_ns(bench_fn fn, void *arg, unsigned long iterations, int repeats);
+
+uint64_t bench_now_ns(void);
+
+/**
+ * Prints a result and checks it against the baseline, if one was given
+ */
+void bench_report(const char *name, double value, const char *unit);
+
+/**
+ * Writes the --record file if requested and releases resources
+ * @return the exit status for main: 0, or 1 if any result regressed
+ */
+int bench_finish(void);
+
+#endif /* BENCH_BENCH_H */
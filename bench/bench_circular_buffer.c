@@ -0,0 +1,121 @@
+/**
+ * @file bench_circular_buffer.c
+ * @brief Times adding entries to and finding positions in aesd-circular-buffer, whose
+ * capacity is fixed at AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, and in aesd-ring rings
+ * of larger capacities, for several entry sizes.
+ */
+
+#include <stdio.h>
+#include "bench.h"
+#include "aesd-circular-buffer.h"
+#include "aesd-ring.h"
+
+#define ADD_ITERATIONS 2000000
+#define FIND_ITERATIONS 2000000
+#define REPEATS 5
+
+static const size_t entry_sizes[] = { 16, 256, 4096 };
+static char entry_data[4096];
+
+AESD_RING_DECLARE_SIZED(ring16, struct aesd_buffer_entry, 4, size)
+AESD_RING_DECLARE_SIZED(ring256, struct aesd_buffer_entry, 8, size)
+AESD_RING_DECLARE_SIZED(ring4096, struct aesd_buffer_entry, 12, size)
+
+struct cb_ctx
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entry;
+};
+
+static void cb_add(void *arg, unsigned long iteration)
+{
+    struct cb_ctx *ctx = arg;
+    aesd_circular_buffer_add_entry(&ctx->buffer, &ctx->entry);
+}
+
+static void cb_find(void *arg, unsigned long iteration)
+{
+    struct cb_ctx *ctx = arg;
+    size_t offset;
+    aesd_circular_buffer_find_entry_offset_for_fpos(&ctx->buffer,
+            (iteration * 7919) % ctx->buffer.total_size, &offset);
+}
+
+static void bench_cb(size_t entry_size)
+{
+    static struct cb_ctx ctx;
+    char name[64];
+    int i;
+
+    aesd_circular_buffer_init(&ctx.buffer);
+    ctx.entry.buffptr = entry_data;
+    ctx.entry.size = entry_size;
+    snprintf(name, sizeof(name), "cb_add_cap%d_size%zu", AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, entry_size);
+    bench_report(name, bench_measure_ns(cb_add, &ctx, ADD_ITERATIONS, REPEATS), "ns/op");
+    for (i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++) {
+        aesd_circular_buffer_add_entry(&ctx.buffer, &ctx.entry);
+    }
+    snprintf(name, sizeof(name), "cb_find_cap%d_size%zu", AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, entry_size);
+    bench_report(name, bench_measure_ns(cb_find, &ctx, FIND_ITERATIONS, REPEATS), "ns/op");
+}
+
+/**
+ * Defines bench_<ring>(entry_size), timing add and find on a full ring declared as <ring>
+ */
+#define DEFINE_RING_BENCH(ring)                                                             \
+struct ring##_ctx                                                                           \
+{                                                                                           \
+    struct ring ring;                                                                       \
+    struct aesd_buffer_entry entry;                                                         \
+};                                                                                          \
+                                                                                            \
+static void ring##_bench_add(void *arg, unsigned long iteration)                            \
+{                                                                                           \
+    struct ring##_ctx *ctx = arg;                                                           \
+    ring##_add(&ctx->ring, &ctx->entry, NULL);                                              \
+}                                                                                           \
+                                                                                            \
+static void ring##_bench_find(void *arg, unsigned long iteration)                           \
+{                                                                                           \
+    struct ring##_ctx *ctx = arg;                                                           \
+    size_t offset;                                                                          \
+    ring##_find_fpos(&ctx->ring, (iteration * 7919) % ring##_total_size(&ctx->ring), &offset); \
+}                                                                                           \
+                                                                                            \
+static void bench_##ring(size_t entry_size, unsigned int capacity)                          \
+{                                                                                           \
+    static struct ring##_ctx ctx;                                                           \
+    char name[64];                                                                          \
+    unsigned int i;                                                                         \
+                                                                                            \
+    ring##_init(&ctx.ring);                                                                 \
+    ctx.entry.buffptr = entry_data;                                                         \
+    ctx.entry.size = entry_size;                                                            \
+    snprintf(name, sizeof(name), "ring_add_cap%u_size%zu", capacity, entry_size);           \
+    bench_report(name, bench_measure_ns(ring##_bench_add, &ctx, ADD_ITERATIONS, REPEATS), "ns/op"); \
+    for (i = 0; i < capacity; i++) {                                                        \
+        ring##_add(&ctx.ring, &ctx.entry, NULL);                                            \
+    }                                                                                       \
+    snprintf(name, sizeof(name), "ring_find_cap%u_size%zu", capacity, entry_size);          \
+    bench_report(name, bench_measure_ns(ring##_bench_find, &ctx, FIND_ITERATIONS, REPEATS), "ns/op"); \
+}
+
+DEFINE_RING_BENCH(ring16)
+DEFINE_RING_BENCH(ring256)
+DEFINE_RING_BENCH(ring4096)
+
+int main(int argc, char **argv)
+{
+    size_t i;
+
+    if (bench_init(argc, argv) != 0) {
+        return 2;
+    }
+    for (i = 0; i < sizeof(entry_sizes) / sizeof(entry_sizes[0]); i++) {
+        bench_cb(entry_sizes[i]);
+        bench_ring16(entry_sizes[i], 16);
+        bench_ring256(entry_sizes[i], 256);
+        bench_ring4096(entry_sizes[i], 4096);
+    }
+    return bench_finish();
+}
@@ -0,0 +1,128 @@
+/**
+ * @file bench_systemcalls.c
+ * @brief Times the cost of running a trivial command through do_system, do_exec,
+ * do_exec_redirect, do_exec_capture, do_exec_batch and the exec server, which is dominated
+ * by process creation and reaping.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "bench.h"
+#include "systemcalls.h"
+
+#define SPAWN_ITERATIONS 200
+#define REPEATS 5
+#define REDIRECT_FILE "bench_systemcalls.out"
+#define BATCH_SIZE 16
+#define BATCH_PARALLEL 4
+/* Resident memory of the parent for the large parent case, in 4K pages */
+#define LARGE_RSS (128 << 20)
+
+static void run_system(void *arg, unsigned long iteration)
+{
+    do_system("true");
+}
+
+static void run_exec(void *arg, unsigned long iteration)
+{
+    do_exec(1, "/bin/true");
+}
+
+static void run_exec_args(void *arg, unsigned long iteration)
+{
+    do_exec(3, "/bin/echo", "-n", "aesd");
+}
+
+static void run_exec_redirect(void *arg, unsigned long iteration)
+{
+    do_exec_redirect(REDIRECT_FILE, 2, "/bin/echo", "aesd");
+}
+
+static void run_exec_capture(void *arg, unsigned long iteration)
+{
+    static char data[64];
+    struct exec_output out = { .data = data, .cap = sizeof(data) };
+
+    do_exec_capture(&out, NULL, 2, "/bin/echo", "aesd");
+}
+
+static void run_exec_server(void *arg, unsigned long iteration)
+{
+    static char *const argv[] = { "/bin/true", NULL };
+    int status;
+    int id = exec_server_submit(argv, NULL);
+
+    if (id >= 0) {
+        exec_server_wait(id, &status);
+    }
+}
+
+/* BATCH_SIZE commands per call, so the result is divided by BATCH_SIZE */
+static void run_exec_batch(void *arg, unsigned long iteration)
+{
+    static char *const argv[] = { "/bin/true", NULL };
+    struct exec_batch_cmd cmds[BATCH_SIZE];
+    int i;
+
+    for (i = 0; i < BATCH_SIZE; i++) {
+        cmds[i].argv = argv;
+        cmds[i].outputfile = NULL;
+    }
+    do_exec_batch(cmds, BATCH_SIZE, BATCH_PARALLEL);
+}
+
+/**
+ * @return a mapping of LARGE_RSS resident bytes in 4K pages, or NULL
+ */
+static char *map_large_rss(void)
+{
+    char *rss = mmap(NULL, LARGE_RSS, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (rss == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(rss, LARGE_RSS, MADV_NOHUGEPAGE);
+    memset(rss, 1, LARGE_RSS);
+    return rss;
+}
+
+int main(int argc, char **argv)
+{
+    char *rss;
+
+    if (bench_init(argc, argv) != 0) {
+        return 2;
+    }
+    bench_report("do_system_true", bench_measure_ns(run_system, NULL, SPAWN_ITERATIONS, REPEATS), "ns/op");
+    bench_report("do_exec_true", bench_measure_ns(run_exec, NULL, SPAWN_ITERATIONS, REPEATS), "ns/op");
+    bench_report("do_exec_echo", bench_measure_ns(run_exec_args, NULL, SPAWN_ITERATIONS, REPEATS), "ns/op");
+    bench_report("do_exec_redirect_echo",
+            bench_measure_ns(run_exec_redirect, NULL, SPAWN_ITERATIONS, REPEATS), "ns/op");
+    bench_report("do_exec_capture_echo",
+            bench_measure_ns(run_exec_capture, NULL, SPAWN_ITERATIONS, REPEATS), "ns/op");
+    bench_report("do_exec_batch_true_par4",
+            bench_measure_ns(run_exec_batch, NULL, SPAWN_ITERATIONS / BATCH_SIZE, REPEATS) / BATCH_SIZE,
+            "ns/op");
+    // spawning copies nothing of the parent, so its size should not matter
+    rss = map_large_rss();
+    if (rss != NULL) {
+        bench_report("do_exec_true_rss128m", bench_measure_ns(run_exec, NULL, SPAWN_ITERATIONS, REPEATS), "ns/op");
+        munmap(rss, LARGE_RSS);
+    }
+    // do_exec goes through the server from here on, so it is started last while still small
+    if (exec_server_start()) {
+        bench_report("exec_server_true", bench_measure_ns(run_exec_server, NULL, SPAWN_ITERATIONS, REPEATS),
+                "ns/op");
+        rss = map_large_rss();
+        if (rss != NULL) {
+            bench_report("exec_server_true_rss128m",
+                    bench_measure_ns(run_exec_server, NULL, SPAWN_ITERATIONS, REPEATS), "ns/op");
+            munmap(rss, LARGE_RSS);
+        }
+        exec_server_stop();
+    }
+    unlink(REDIRECT_FILE);
+    return bench_finish();
+}
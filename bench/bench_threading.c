@@ -0,0 +1,62 @@
+/**
+ * @file bench_threading.c
+ * @brief Times start_thread_obtaining_mutex with several threads contending for one
+ * mutex, from the first thread started until the last one is joined.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "threading.h"
+
+#define THREAD_ROUNDS 200
+#define REPEATS 5
+#define MAX_THREADS 16
+
+static const int thread_counts[] = { 1, 4, MAX_THREADS };
+
+struct contention_ctx
+{
+    pthread_mutex_t mutex;
+    int threads;
+};
+
+static void run_contention(void *arg, unsigned long iteration)
+{
+    struct contention_ctx *ctx = arg;
+    pthread_t thread[MAX_THREADS];
+    bool started[MAX_THREADS];
+    void *thread_rtn;
+    int i;
+
+    for (i = 0; i < ctx->threads; i++) {
+        started[i] = start_thread_obtaining_mutex(&thread[i], &ctx->mutex, 0, 0);
+    }
+    for (i = 0; i < ctx->threads; i++) {
+        // the joiner owns the thread_data returned by the thread
+        if (started[i] && pthread_join(thread[i], &thread_rtn) == 0) {
+            free(thread_rtn);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct contention_ctx ctx;
+    char name[64];
+    size_t i;
+
+    if (bench_init(argc, argv) != 0) {
+        return 2;
+    }
+    pthread_mutex_init(&ctx.mutex, NULL);
+    for (i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++) {
+        ctx.threads = thread_counts[i];
+        snprintf(name, sizeof(name), "mutex_threads_%d", ctx.threads);
+        bench_report(name, bench_measure_ns(run_contention, &ctx, THREAD_ROUNDS, REPEATS) / ctx.threads,
+                "ns/thread");
+    }
+    pthread_mutex_destroy(&ctx.mutex);
+    return bench_finish();
+}
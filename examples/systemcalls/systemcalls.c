@@ -1,5 +1,23 @@
+#define _GNU_SOURCE
 #include "systemcalls.h"
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+/* Smallest buffer do_exec_capture grows a growable exec_output to */
+#define EXEC_OUTPUT_MIN_GROW 4096
+/* Largest amount moved by one splice call while streaming */
+#define EXEC_STREAM_CHUNK (64 * 1024)
+/* Largest request to the exec server, larger commands are spawned directly */
+#define EXEC_SERVER_MAX_MSG (64 * 1024)
+
+extern char **environ;
 
 /**
  * @param cmd the command to execute with system()
@@ -27,6 +45,89 @@ bool do_system(const char *cmd)
     return true;
 }
 
+/**
+ * Starts @param command with posix_spawn, which uses vfork semantics so the parent's
+ * page tables are not copied no matter how large it is.
+ * @param command a NULL terminated argument vector, command[0] being the absolute path
+ *   of the program to run
+ * @param out_fd if not -1, the descriptor the child gets as standard out
+ * @param err_fd if not -1, the descriptor the child gets as standard error
+ * @return the child's pid, or -1 if it could not be started
+ */
+static pid_t spawn_command(char *const command[], int out_fd, int err_fd)
+{
+    posix_spawn_file_actions_t actions;
+    pid_t pid;
+    int rc;
+
+    rc = posix_spawn_file_actions_init(&actions);
+    if (rc == 0)
+    {
+        if (out_fd != -1)
+        {
+            rc = posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+        }
+        if (rc == 0 && err_fd != -1)
+        {
+            rc = posix_spawn_file_actions_adddup2(&actions, err_fd, STDERR_FILENO);
+        }
+        if (rc == 0)
+        {
+            // unlike posix_spawnp, posix_spawn does no path search, matching execv
+            rc = posix_spawn(&pid, command[0], &actions, NULL, command, environ);
+        }
+        posix_spawn_file_actions_destroy(&actions);
+    }
+    if (rc != 0)
+    {
+        fprintf(stderr, "%s: %s\n", command[0], strerror(rc));
+        return -1;
+    }
+    return pid;
+}
+
+/**
+ * Starts @param command as spawn_command does, with standard out redirected to
+ * @param outputfile if it is not NULL, truncating it first
+ */
+static pid_t spawn_command_to_file(char *const command[], const char *outputfile)
+{
+    int fd;
+    pid_t pid;
+
+    if (outputfile == NULL)
+    {
+        return spawn_command(command, -1, -1);
+    }
+    // opened here rather than as a spawn file action, which is measurably slower
+    fd = open(outputfile, O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        perror(outputfile);
+        return -1;
+    }
+    pid = spawn_command(command, fd, -1);
+    close(fd);
+    return pid;
+}
+
+/**
+ * Waits for @param pid to exit
+ * @return true if it exited with status 0
+ */
+static bool wait_command(pid_t pid, int *status)
+{
+    while (waitpid(pid, status, 0) == -1)
+    {
+        if (errno != EINTR)
+        {
+            perror("waitpid");
+            return false;
+        }
+    }
+    return WIFEXITED(*status) && WEXITSTATUS(*status) == 0;
+}
+
 /**
  * @param count -The numbers of variables passed to the function. The variables are command to execute.
  *   followed by arguments to pass to the command
@@ -57,131 +158,839 @@ bool do_exec(int count, ...)
         command[i] = va_arg(args, char *);
     }
     command[count] = NULL;
-    // this line is to avoid a compile warning before your implementation is complete
-    // and may be removed
-    command[count] = command[count];
+    va_end(args);
 
-    /*
-     * TODO:
-     *   Execute a system command by calling fork, execv(),
-     *   and wait instead of system (see LSP page 161).
-     *   Use the command[0] as the full path to the command to execute
-     *   (first argument to execv), and use the remaining arguments
-     *   as second argument to the execv() command.
-     *
-     */
+    int status;
+    int id = exec_server_submit(command, NULL);
+    if (id >= 0)
+    {
+        return exec_server_wait(id, &status);
+    }
+    pid_t pid = spawn_command(command, -1, -1);
+    if (pid == -1)
+    {
+        return false;
+    }
+    return wait_command(pid, &status);
+}
+
+/**
+ * @param outputfile - The full path to the file to write with command output.
+ *   This file will be closed at completion of the function call.
+ * All other parameters, see do_exec above
+ */
+bool do_exec_redirect(const char *outputfile, int count, ...)
+{
+    va_list args;
+    va_start(args, count);
+    char *command[count + 1];
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        command[i] = va_arg(args, char *);
+    }
+    command[count] = NULL;
+    va_end(args);
 
-    // fork a child process
-    pid_t pid = fork();
+    int status;
+    int id = exec_server_submit(command, outputfile);
+    if (id >= 0)
+    {
+        return exec_server_wait(id, &status);
+    }
+    pid_t pid = spawn_command_to_file(command, outputfile);
     if (pid == -1)
     {
-        perror("fork failed");
         return false;
     }
+    return wait_command(pid, &status);
+}
 
-    // if fork() returns 0, we are in the child process
-    if (pid == 0)
+/**
+ * Where the parent sends what a child writes to one of its output pipes
+ */
+struct output_stream
+{
+    /* Read end of the pipe, -1 once the child closed it */
+    int pipe_fd;
+    /* Buffer to append to, or NULL to pass the data to dest_fd */
+    struct exec_output *buf;
+    int dest_fd;
+};
+
+/**
+ * Appends what is waiting in @param stream's pipe to its buffer, growing the buffer if
+ * allowed.  Data which does not fit is read and dropped, so the child never blocks.
+ * @return bytes read, 0 at end of file, -1 on error
+ */
+static ssize_t capture_pipe(struct output_stream *stream)
+{
+    struct exec_output *out = stream->buf;
+    char discard[4096];
+    ssize_t n;
+
+    if (out->len == out->cap && out->growable)
+    {
+        size_t cap = out->cap < EXEC_OUTPUT_MIN_GROW ? EXEC_OUTPUT_MIN_GROW : out->cap * 2;
+        char *data = realloc(out->data, cap);
+        if (data != NULL)
+        {
+            out->data = data;
+            out->cap = cap;
+        }
+    }
+    if (out->len == out->cap)
     {
-        // if execv failed
-        if (execv(command[0], command) == -1)
+        n = read(stream->pipe_fd, discard, sizeof(discard));
+        if (n > 0)
         {
-            printf("child failed");
-            perror(command[0]);
-            exit(1);
+            out->truncated = true;
         }
+        return n;
     }
-    // else we are in the parent process
-    else
+    n = read(stream->pipe_fd, out->data + out->len, out->cap - out->len);
+    if (n > 0)
     {
-        int status;
-        // wait for the child process to finish
-        waitpid(pid, &status, 0);
+        out->len += n;
+    }
+    return n;
+}
 
-        // if the child process terminated
-        if (status != 0)
+/**
+ * Moves what is waiting in @param stream's pipe to its destination descriptor, with
+ * splice so the data stays in the kernel.  Destinations splice cannot write to, such
+ * as files opened with O_APPEND, are written through a buffer instead.
+ * @return bytes moved, 0 at end of file, -1 on error
+ */
+static ssize_t stream_pipe(struct output_stream *stream)
+{
+    char buf[4096];
+    ssize_t n;
+    ssize_t written;
+    ssize_t rc;
+
+    n = splice(stream->pipe_fd, NULL, stream->dest_fd, NULL, EXEC_STREAM_CHUNK, SPLICE_F_MOVE);
+    if (n != -1 || errno != EINVAL)
+    {
+        return n;
+    }
+    n = read(stream->pipe_fd, buf, sizeof(buf));
+    for (written = 0; written < n; written += rc)
+    {
+        rc = write(stream->dest_fd, buf + written, n - written);
+        if (rc == -1)
         {
-            return false;
+            return -1;
         }
-        else
+    }
+    return n;
+}
+
+/**
+ * Drains both output pipes of a child until it closes them.  Both are polled together,
+ * so a child filling one pipe while the parent waits on the other cannot deadlock.
+ * @return true if all output was delivered
+ */
+static bool pump_output(struct output_stream streams[2])
+{
+    struct pollfd fds[2];
+    bool success = true;
+    int i;
+
+    while (streams[0].pipe_fd != -1 || streams[1].pipe_fd != -1)
+    {
+        for (i = 0; i < 2; i++)
+        {
+            // negative descriptors are ignored by poll
+            fds[i].fd = streams[i].pipe_fd;
+            fds[i].events = POLLIN;
+        }
+        if (poll(fds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("poll");
+            success = false;
+            break;
+        }
+        for (i = 0; i < 2; i++)
+        {
+            if (fds[i].fd == -1 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+                continue;
+            }
+            ssize_t n = streams[i].buf != NULL ? capture_pipe(&streams[i]) : stream_pipe(&streams[i]);
+            if (n == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n == -1)
+            {
+                perror("exec output");
+                success = false;
+            }
+            if (n <= 0)
+            {
+                close(streams[i].pipe_fd);
+                streams[i].pipe_fd = -1;
+            }
+        }
+    }
+    // on error, closing the pipes lets the child finish with EPIPE rather than block
+    for (i = 0; i < 2; i++)
+    {
+        if (streams[i].pipe_fd != -1)
+        {
+            close(streams[i].pipe_fd);
+        }
+    }
+    return success;
+}
+
+/**
+ * Runs @param command with its standard out and standard error each sent through a
+ * pipe to @param streams[0] and @param streams[1], or inherited for streams without
+ * a buffer and with a dest_fd of -1
+ * @return true if the command ran, exited with status 0 and all output was delivered
+ */
+static bool exec_piped(char *const command[], struct output_stream streams[2])
+{
+    int write_end[2] = { -1, -1 };
+    bool success = true;
+    int status;
+    pid_t pid;
+    int i;
+
+    for (i = 0; i < 2; i++)
+    {
+        int pipefd[2];
+        streams[i].pipe_fd = -1;
+        if (streams[i].buf == NULL && streams[i].dest_fd == -1)
+        {
+            continue;
+        }
+        if (pipe2(pipefd, O_CLOEXEC) == -1)
+        {
+            perror("pipe2");
+            success = false;
+            break;
+        }
+        streams[i].pipe_fd = pipefd[0];
+        write_end[i] = pipefd[1];
+    }
+    pid = success ? spawn_command(command, write_end[0], write_end[1]) : -1;
+    // the child holds the write ends now, so end of file arrives when it exits
+    for (i = 0; i < 2; i++)
+    {
+        if (write_end[i] != -1)
+        {
+            close(write_end[i]);
+        }
+    }
+    if (pid == -1)
+    {
+        for (i = 0; i < 2; i++)
         {
-            return true;
+            if (streams[i].pipe_fd != -1)
+            {
+                close(streams[i].pipe_fd);
+            }
         }
+        return false;
     }
+    success = pump_output(streams);
+    return wait_command(pid, &status) && success;
+}
+
+/**
+ * Builds the argument vector for do_exec_capture and do_exec_stream from @param args
+ */
+#define COLLECT_COMMAND(command, count, args)       \
+    do                                              \
+    {                                               \
+        int i_;                                     \
+        for (i_ = 0; i_ < (count); i_++)            \
+        {                                           \
+            (command)[i_] = va_arg(args, char *);   \
+        }                                           \
+        (command)[count] = NULL;                    \
+    } while (0)
 
+/**
+ * Runs a command as do_exec does, capturing its output in memory instead of a file.
+ * @param out if not NULL, receives standard out.  Data is appended after out->len.  With
+ *   out->growable set the buffer is grown with realloc as needed (out->data may start
+ *   NULL) and the caller frees it; otherwise output past out->cap is dropped and
+ *   out->truncated is set.
+ * @param err if not NULL, receives standard error the same way
+ * @param count, ... see do_exec above
+ * @return true if the command ran and exited with status 0.  Output is stored even
+ *   when it did not.
+ */
+bool do_exec_capture(struct exec_output *out, struct exec_output *err, int count, ...)
+{
+    va_list args;
+    va_start(args, count);
+    char *command[count + 1];
+    COLLECT_COMMAND(command, count, args);
     va_end(args);
-    return true;
+
+    struct output_stream streams[2] = {
+        { .buf = out, .dest_fd = -1 },
+        { .buf = err, .dest_fd = -1 },
+    };
+    return exec_piped(command, streams);
 }
 
 /**
- * @param outputfile - The full path to the file to write with command output.
- *   This file will be closed at completion of the function call.
- * All other parameters, see do_exec above
+ * Runs a command as do_exec does, streaming its output to descriptors through pipes.
+ * The parent relays all data, so @param out_fd and @param err_fd are never handed to
+ * the child and may be any descriptor splice or write accepts, such as a socket.  A
+ * caller streaming to a socket or pipe which may be closed should ignore SIGPIPE.
+ * @param out_fd receives standard out, or -1 to leave it inherited
+ * @param err_fd receives standard error, or -1 to leave it inherited
+ * @param count, ... see do_exec above
+ * @return true if the command ran, exited with status 0 and all output was delivered
  */
-bool do_exec_redirect(const char *outputfile, int count, ...)
+bool do_exec_stream(int out_fd, int err_fd, int count, ...)
 {
     va_list args;
     va_start(args, count);
     char *command[count + 1];
-    int i;
-    for (i = 0; i < count; i++)
+    COLLECT_COMMAND(command, count, args);
+    va_end(args);
+
+    struct output_stream streams[2] = {
+        { .buf = NULL, .dest_fd = out_fd },
+        { .buf = NULL, .dest_fd = err_fd },
+    };
+    return exec_piped(command, streams);
+}
+
+/**
+ * @return a pidfd for @param pid, or -1 if the kernel has no pidfd_open (before Linux 5.3)
+ */
+static int open_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/**
+ * Runs every command in @param cmds, with at most @param max_parallel running at once,
+ * starting the next one as soon as any running command exits.  Completions are
+ * detected by polling a pidfd per running command; a command without a pidfd (before
+ * Linux 5.3) is waited for directly once finished commands have been collected.
+ * @param cmds the commands to run.  Each command's status is set to its wait status,
+ *   or -1 if it could not be started.
+ * @param count the number of entries in @param cmds
+ * @param max_parallel the concurrency limit, 0 for no limit
+ * @return true if every command was started and exited with status 0
+ */
+bool do_exec_batch(struct exec_batch_cmd *cmds, size_t count, unsigned int max_parallel)
+{
+    if (max_parallel == 0 || max_parallel > count)
     {
-        command[i] = va_arg(args, char *);
+        max_parallel = count;
     }
-    command[count] = NULL;
-    // this line is to avoid a compile warning before your implementation is complete
-    // and may be removed
-    command[count] = command[count];
+    if (count == 0)
+    {
+        return true;
+    }
+    struct pollfd fds[max_parallel];
+    pid_t pids[max_parallel];
+    size_t running_cmd[max_parallel];
+    unsigned int running = 0;
+    size_t next = 0;
+    bool success = true;
+    unsigned int i;
 
-    /*
-     * TODO
-     *   Call execv, but first using https://stackoverflow.com/a/13784315/1446624 as a refernce,
-     *   redirect standard out to a file specified by outputfile.
-     *   The rest of the behaviour is same as do_exec()
-     *
-     */
+    while (next < count || running > 0)
+    {
+        // fill every free slot
+        while (next < count && running < max_parallel)
+        {
+            struct exec_batch_cmd *cmd = &cmds[next];
+            cmd->status = -1;
+            pids[running] = spawn_command_to_file(cmd->argv, cmd->outputfile);
+            if (pids[running] == -1)
+            {
+                success = false;
+                next++;
+                continue;
+            }
+            fds[running].fd = open_pidfd(pids[running]);
+            fds[running].events = POLLIN;
+            fds[running].revents = 0;
+            running_cmd[running] = next++;
+            running++;
+        }
+        if (running == 0)
+        {
+            break;
+        }
+        // pidfds become readable when their process exits.  A command without a pidfd
+        // is waited for directly, after collecting whatever already finished.
+        int blocking_slot = -1;
+        for (i = 0; i < running && blocking_slot == -1; i++)
+        {
+            if (fds[i].fd == -1)
+            {
+                blocking_slot = i;
+            }
+        }
+        while (poll(fds, running, blocking_slot == -1 ? -1 : 0) == -1)
+        {
+            if (errno != EINTR)
+            {
+                // still reap every command, one at a time; revents are not valid
+                perror("poll");
+                for (i = 0; i < running; i++)
+                {
+                    fds[i].revents = 0;
+                }
+                blocking_slot = 0;
+                break;
+            }
+        }
+        unsigned int kept = 0;
+        for (i = 0; i < running; i++)
+        {
+            bool exited = (fds[i].fd != -1 && (fds[i].revents & (POLLIN | POLLHUP)))
+                          || (int)i == blocking_slot;
+            if (!exited)
+            {
+                // compact the slots still running
+                fds[kept] = fds[i];
+                pids[kept] = pids[i];
+                running_cmd[kept] = running_cmd[i];
+                kept++;
+                continue;
+            }
+            if (!wait_command(pids[i], &cmds[running_cmd[i]].status))
+            {
+                success = false;
+            }
+            if (fds[i].fd != -1)
+            {
+                close(fds[i].fd);
+            }
+        }
+        running = kept;
+    }
+    return success;
+}
+
+/*
+ * Exec server: a helper process forked by exec_server_start, ideally early while the
+ * caller is still small, which spawns commands on request and reports their exit
+ * statuses.  Requests and replies are single SOCK_SEQPACKET messages on a socketpair,
+ * so any number of commands can be in flight and replies arrive in completion order.
+ */
+
+struct exec_server_request
+{
+    uint32_t id;
+    uint32_t argc;
+    uint32_t has_outputfile;
+    /* followed by the NUL terminated outputfile, if any, then argc NUL terminated arguments */
+};
+
+struct exec_server_reply
+{
+    uint32_t id;
+    /* wait status, or -1 if the command could not be started */
+    int32_t status;
+};
+
+static int exec_server_sock = -1;
+static pid_t exec_server_pid = -1;
+static uint32_t exec_server_next_id;
+static pthread_mutex_t exec_server_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t exec_server_cond = PTHREAD_COND_INITIALIZER;
+/* Set while one waiting thread is receiving replies on behalf of all of them */
+static bool exec_server_receiving;
+static bool exec_server_failed;
+/* Replies received but not yet claimed by exec_server_wait */
+static struct exec_server_reply *exec_server_done;
+static size_t exec_server_done_count;
+static size_t exec_server_done_cap;
+
+static int exec_server_sigchld_pipe[2];
+
+static void exec_server_sigchld(int signal_number)
+{
+    int saved_errno = errno;
+    (void)signal_number;
+    // a full pipe already holds a wakeup
+    if (write(exec_server_sigchld_pipe[1], "", 1) == -1)
+    {
+    }
+    errno = saved_errno;
+}
+
+/**
+ * Spawns the command in the request @param msg of @param len bytes
+ * @return the child's pid, or -1 if the request is malformed or the spawn failed
+ */
+static pid_t exec_server_spawn(char *msg, size_t len)
+{
+    struct exec_server_request *req = (struct exec_server_request *)msg;
+    char *end = msg + len;
+    char *p = msg + sizeof(*req);
+    const char *outputfile = NULL;
+    uint32_t i;
+
+    if (len < sizeof(*req) || req->argc == 0 || req->argc > len || end[-1] != '\0')
+    {
+        return -1;
+    }
+    char *command[req->argc + 1];
+    if (req->has_outputfile)
+    {
+        outputfile = p;
+        p += strlen(p) + 1;
+    }
+    for (i = 0; i < req->argc; i++)
+    {
+        if (p >= end)
+        {
+            return -1;
+        }
+        command[i] = p;
+        p += strlen(p) + 1;
+    }
+    command[req->argc] = NULL;
+    return spawn_command_to_file(command, outputfile);
+}
+
+/**
+ * Closes every descriptor the exec server inherited except standard in, out and error
+ * and @param sock, so it does not hold the caller's pipes and sockets open.  sock is
+ * close-on-exec, so the commands the server spawns see the same descriptors as commands
+ * started directly and cannot read or forge requests.
+ * @return the descriptor sock now has
+ */
+static int exec_server_close_fds(int sock)
+{
+    int fd;
+    long max_fd;
+
+    // dup2 clears FD_CLOEXEC, and an inherited sock may already be 3 without it
+    if ((sock != 3 && dup2(sock, 3) == -1) || fcntl(3, F_SETFD, FD_CLOEXEC) == -1)
+    {
+        _exit(1);
+    }
+    sock = 3;
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, 4, ~0U, 0) == 0)
+    {
+        return sock;
+    }
+#endif
+    max_fd = sysconf(_SC_OPEN_MAX);
+    if (max_fd < 0 || max_fd > 65536)
+    {
+        max_fd = 65536;
+    }
+    for (fd = 4; fd < max_fd; fd++)
+    {
+        close(fd);
+    }
+    return sock;
+}
+
+/**
+ * The exec server's main loop, serving requests on @param sock until it is shut down
+ * and every command started has exited
+ */
+static void exec_server_main(int sock)
+{
+    struct
+    {
+        pid_t pid;
+        uint32_t id;
+    } *running = NULL;
+    size_t running_count = 0;
+    size_t running_cap = 0;
+    static char msg[EXEC_SERVER_MAX_MSG];
+    struct sigaction action;
+    struct pollfd fds[2];
+    bool open = true;
+
+    sock = exec_server_close_fds(sock);
+    if (pipe2(exec_server_sigchld_pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+    {
+        _exit(1);
+    }
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = exec_server_sigchld;
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &action, NULL);
 
-    int child_pid;
-    int fd = open(outputfile, O_WRONLY | O_TRUNC | O_CREAT, 0644);
-    if (fd < 0)
+    while (open || running_count > 0)
     {
+        fds[0].fd = open ? sock : -1;
+        fds[0].events = POLLIN;
+        fds[1].fd = exec_server_sigchld_pipe[0];
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            ssize_t n = recv(sock, msg, sizeof(msg), 0);
+            if (n <= 0)
+            {
+                // the caller stopped the server or exited
+                open = false;
+            }
+            else
+            {
+                struct exec_server_reply reply = { ((struct exec_server_request *)msg)->id, -1 };
+                if (running_count == running_cap)
+                {
+                    running_cap = running_cap * 2 + 16;
+                    running = realloc(running, running_cap * sizeof(*running));
+                    if (running == NULL)
+                    {
+                        _exit(1);
+                    }
+                }
+                pid_t pid = exec_server_spawn(msg, n);
+                if (pid == -1)
+                {
+                    send(sock, &reply, sizeof(reply), MSG_NOSIGNAL);
+                }
+                else
+                {
+                    running[running_count].pid = pid;
+                    running[running_count].id = reply.id;
+                    running_count++;
+                }
+            }
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            char drain[64];
+            int status;
+            pid_t pid;
+            while (read(exec_server_sigchld_pipe[0], drain, sizeof(drain)) > 0)
+            {
+            }
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+            {
+                size_t i;
+                for (i = 0; i < running_count && running[i].pid != pid; i++)
+                {
+                }
+                if (i < running_count)
+                {
+                    struct exec_server_reply reply = { running[i].id, status };
+                    send(sock, &reply, sizeof(reply), MSG_NOSIGNAL);
+                    running[i] = running[--running_count];
+                }
+            }
+        }
+    }
+    _exit(0);
+}
+
+/**
+ * Starts the exec server.  While it runs, do_exec and do_exec_redirect hand their
+ * commands to it instead of spawning from the calling process, which keeps spawning
+ * cost and memory pressure independent of the caller's size.  The server keeps the
+ * working directory and environment the caller had when it was started, so commands
+ * and output files should be given as absolute paths.
+ * @return true if the server is running
+ */
+bool exec_server_start(void)
+{
+    int sv[2];
+    pid_t pid;
 
-        perror("open");
+    if (exec_server_sock != -1)
+    {
+        return true;
+    }
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1)
+    {
+        perror("socketpair");
         return false;
     }
-    int status;
-    switch (child_pid = fork())
+    fflush(NULL);
+    pid = fork();
+    if (pid == -1)
     {
-    case -1:
         perror("fork");
+        close(sv[0]);
+        close(sv[1]);
         return false;
+    }
+    if (pid == 0)
+    {
+        close(sv[0]);
+        exec_server_main(sv[1]);
+    }
+    close(sv[1]);
+    exec_server_sock = sv[0];
+    exec_server_pid = pid;
+    exec_server_failed = false;
+    return true;
+}
+
+/**
+ * Stops the exec server once every command it started has exited.  No thread may be
+ * submitting or waiting for commands during the call.
+ */
+void exec_server_stop(void)
+{
+    int status;
+
+    if (exec_server_sock == -1)
+    {
+        return;
+    }
+    close(exec_server_sock);
+    exec_server_sock = -1;
+    while (waitpid(exec_server_pid, &status, 0) == -1 && errno == EINTR)
+    {
+    }
+    exec_server_pid = -1;
+    free(exec_server_done);
+    exec_server_done = NULL;
+    exec_server_done_count = 0;
+    exec_server_done_cap = 0;
+}
+
+/**
+ * Asks the exec server to start @param command without waiting for it to finish
+ * @param command a NULL terminated argument vector, command[0] being an absolute path
+ * @param outputfile if not NULL, the file to redirect standard out to, as in
+ *   do_exec_redirect
+ * @return an id to pass to exec_server_wait, or -1 if the server is not running or
+ *   the request is too large, in which case the caller should spawn the command itself
+ */
+int exec_server_submit(char *const command[], const char *outputfile)
+{
+    char msg[EXEC_SERVER_MAX_MSG];
+    struct exec_server_request *req = (struct exec_server_request *)msg;
+    size_t len = sizeof(*req);
+    size_t n;
+    int i;
 
-    case 0:
-        if (dup2(fd, 1) < 0)
+    if (exec_server_sock == -1 || exec_server_failed)
+    {
+        return -1;
+    }
+    req->argc = 0;
+    req->has_outputfile = outputfile != NULL;
+    for (i = -1; i == -1 || command[i] != NULL; i++)
+    {
+        const char *arg = i == -1 ? outputfile : command[i];
+        if (arg == NULL)
         {
-            perror("dup2");
-            return false;
+            continue;
         }
-        close(fd);
-
-        execv(command[0], command);
-        perror(command[0]);
-        exit(1);
-    default:
+        n = strlen(arg) + 1;
+        if (len + n > sizeof(msg))
+        {
+            return -1;
+        }
+        memcpy(msg + len, arg, n);
+        len += n;
+        req->argc += i >= 0;
+    }
+    req->id = __atomic_fetch_add(&exec_server_next_id, 1, __ATOMIC_RELAXED) & INT32_MAX;
+    // a seqpacket message is sent whole, so concurrent submits need no lock
+    if (send(exec_server_sock, msg, len, MSG_NOSIGNAL) != (ssize_t)len)
+    {
+        return -1;
+    }
+    return req->id;
+}
 
-        waitpid(child_pid, &status, 0);
+/**
+ * Waits for the command submitted as @param id to exit.  Several threads may wait at
+ * once; whichever is receiving hands the others their replies.
+ * @param status set to the command's wait status, or -1 if it could not be started
+ * @return true if the command exited with status 0
+ */
+bool exec_server_wait(int id, int *status)
+{
+    struct exec_server_reply reply;
+    size_t i;
 
-        if (WIFEXITED(status))
+    *status = -1;
+    pthread_mutex_lock(&exec_server_lock);
+    for (;;)
+    {
+        for (i = 0; i < exec_server_done_count && exec_server_done[i].id != (uint32_t)id; i++)
         {
-            printf("Child process exited with status: %d\n", WEXITSTATUS(status));
+        }
+        if (i < exec_server_done_count)
+        {
+            *status = exec_server_done[i].status;
+            exec_server_done[i] = exec_server_done[--exec_server_done_count];
+            break;
+        }
+        if (exec_server_failed)
+        {
+            break;
+        }
+        if (exec_server_receiving)
+        {
+            pthread_cond_wait(&exec_server_cond, &exec_server_lock);
+            continue;
+        }
+        exec_server_receiving = true;
+        pthread_mutex_unlock(&exec_server_lock);
+        ssize_t n;
+        while ((n = recv(exec_server_sock, &reply, sizeof(reply), 0)) == -1 && errno == EINTR)
+        {
+        }
+        pthread_mutex_lock(&exec_server_lock);
+        exec_server_receiving = false;
+        if (n != sizeof(reply))
+        {
+            fprintf(stderr, "exec server: %s\n", n == 0 ? "exited" : strerror(errno));
+            exec_server_failed = true;
         }
         else
         {
-            printf("Child process terminated abnormally\n");
-            return false;
+            if (exec_server_done_count == exec_server_done_cap)
+            {
+                size_t cap = exec_server_done_cap * 2 + 16;
+                struct exec_server_reply *done = realloc(exec_server_done, cap * sizeof(reply));
+                if (done != NULL)
+                {
+                    exec_server_done = done;
+                    exec_server_done_cap = cap;
+                }
+            }
+            if (exec_server_done_count < exec_server_done_cap)
+            {
+                exec_server_done[exec_server_done_count++] = reply;
+            }
+            else
+            {
+                exec_server_failed = true;
+            }
         }
-        /* do whatever the parent wants to do. */
+        pthread_cond_broadcast(&exec_server_cond);
     }
-    va_end(args);
-
-    return true;
+    pthread_mutex_unlock(&exec_server_lock);
+    return *status != -1 && WIFEXITED(*status) && WEXITSTATUS(*status) == 0;
 }
@@ -13,3 +13,46 @@ bool do_system(const char *command);
 bool do_exec(int count, ...);
 
 bool do_exec_redirect(const char *outputfile, int count, ...);
+
+/**
+ * A memory buffer receiving a command's output from do_exec_capture
+ */
+struct exec_output
+{
+    char *data;
+    /* Bytes stored in data */
+    size_t len;
+    /* Size of data */
+    size_t cap;
+    /* Grow data with realloc when full, rather than dropping further output */
+    bool growable;
+    /* Set when output was dropped because data was full */
+    bool truncated;
+};
+
+bool do_exec_capture(struct exec_output *out, struct exec_output *err, int count, ...);
+
+bool do_exec_stream(int out_fd, int err_fd, int count, ...);
+
+/**
+ * One command of a do_exec_batch call
+ */
+struct exec_batch_cmd
+{
+    /* NULL terminated argument vector, argv[0] being the absolute path of the program */
+    char *const *argv;
+    /* File to redirect standard out to as do_exec_redirect does, or NULL */
+    const char *outputfile;
+    /* Set to the command's wait status, or -1 if it could not be started */
+    int status;
+};
+
+bool do_exec_batch(struct exec_batch_cmd *cmds, size_t count, unsigned int max_parallel);
+
+bool exec_server_start(void);
+
+void exec_server_stop(void);
+
+int exec_server_submit(char *const command[], const char *outputfile);
+
+bool exec_server_wait(int id, int *status);
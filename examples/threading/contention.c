@@ -0,0 +1,175 @@
+#include "contention.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
+struct contention_shared
+{
+    const struct contention_config *config;
+    struct lock lock;
+    pthread_mutex_t start_mutex;
+    pthread_cond_t start_cond;
+    /**
+     * 0 until all threads are created, then 1 to run or -1 to exit at once
+     */
+    int go;
+    /**
+     * Incremented inside the lock, so lost updates show a broken lock
+     */
+    unsigned long counter;
+};
+
+struct contention_thread
+{
+    struct contention_shared *shared;
+    pthread_t thread;
+    uint64_t *latency_ns;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void busy_wait_ns(uint64_t ns)
+{
+    uint64_t end;
+
+    if (ns == 0)
+    {
+        return;
+    }
+    end = now_ns() + ns;
+    while (now_ns() < end)
+    {
+    }
+}
+
+static void *contention_threadfunc(void *thread_param)
+{
+    struct contention_thread *self = thread_param;
+    struct contention_shared *shared = self->shared;
+    const struct contention_config *config = shared->config;
+    uint64_t before;
+    unsigned long i;
+    int go;
+
+    pthread_mutex_lock(&shared->start_mutex);
+    while (shared->go == 0)
+    {
+        pthread_cond_wait(&shared->start_cond, &shared->start_mutex);
+    }
+    go = shared->go;
+    pthread_mutex_unlock(&shared->start_mutex);
+    if (go < 0)
+    {
+        return NULL;
+    }
+    for (i = 0; i < config->acquisitions; i++)
+    {
+        busy_wait_ns(config->wait_ns);
+        before = now_ns();
+        lock_acquire(&shared->lock);
+        self->latency_ns[i] = now_ns() - before;
+        shared->counter++;
+        busy_wait_ns(config->hold_ns);
+        lock_release(&shared->lock);
+    }
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(const uint64_t *sorted, size_t count, int pct)
+{
+    return sorted[(count - 1) * pct / 100];
+}
+
+int contention_run(const struct contention_config *config, struct contention_result *result)
+{
+    struct contention_shared shared = {
+        .config = config,
+        .start_mutex = PTHREAD_MUTEX_INITIALIZER,
+        .start_cond = PTHREAD_COND_INITIALIZER,
+    };
+    struct contention_thread *threads;
+    uint64_t *latency_ns;
+    size_t count;
+    uint64_t start;
+    int started = 0;
+    int rc;
+    int i;
+
+    if (config->threads <= 0 || config->acquisitions == 0)
+    {
+        return EINVAL;
+    }
+    count = (size_t)config->threads * config->acquisitions;
+    threads = calloc(config->threads, sizeof(*threads));
+    latency_ns = malloc(count * sizeof(*latency_ns));
+    if (threads == NULL || latency_ns == NULL)
+    {
+        free(threads);
+        free(latency_ns);
+        return ENOMEM;
+    }
+    rc = lock_init(&shared.lock, config->kind);
+    if (rc != 0)
+    {
+        free(threads);
+        free(latency_ns);
+        return rc;
+    }
+    for (i = 0; i < config->threads; i++)
+    {
+        threads[i].shared = &shared;
+        threads[i].latency_ns = latency_ns + (size_t)i * config->acquisitions;
+        rc = pthread_create(&threads[i].thread, NULL, contention_threadfunc, &threads[i]);
+        if (rc != 0)
+        {
+            break;
+        }
+        started++;
+    }
+    // release the threads together, or tell them to exit if one could not be created
+    pthread_mutex_lock(&shared.start_mutex);
+    shared.go = rc == 0 ? 1 : -1;
+    pthread_cond_broadcast(&shared.start_cond);
+    pthread_mutex_unlock(&shared.start_mutex);
+    start = now_ns();
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+    }
+    result->elapsed_ns = now_ns() - start;
+    lock_destroy(&shared.lock);
+    if (rc != 0)
+    {
+        free(threads);
+        free(latency_ns);
+        return rc;
+    }
+    if (shared.counter != count)
+    {
+        rc = EIO;
+    }
+    qsort(latency_ns, count, sizeof(*latency_ns), compare_u64);
+    result->acquisitions = count;
+    result->acquisitions_per_sec = result->elapsed_ns > 0 ? count * 1e9 / result->elapsed_ns : 0;
+    result->latency_p50_ns = percentile(latency_ns, count, 50);
+    result->latency_p90_ns = percentile(latency_ns, count, 90);
+    result->latency_p99_ns = percentile(latency_ns, count, 99);
+    result->latency_max_ns = latency_ns[count - 1];
+    free(threads);
+    free(latency_ns);
+    return rc;
+}
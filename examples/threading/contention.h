@@ -0,0 +1,57 @@
+/*
+ * contention.h
+ *
+ * A lock contention harness: threads repeatedly wait, acquire a shared struct lock,
+ * hold it and release it, and the harness reports how long acquisitions took and how
+ * many completed per second.  Running the same configuration with each lock_kind shows
+ * which lock suits a given thread count and critical section length.
+ *
+ * Hold and wait times are busy waited rather than slept, so critical sections of a few
+ * hundred nanoseconds, such as an aesdsocket append, can be modelled.
+ */
+
+#ifndef THREADING_CONTENTION_H
+#define THREADING_CONTENTION_H
+
+#include <stdint.h>
+#include "lock.h"
+
+struct contention_config
+{
+    enum lock_kind kind;
+    int threads;
+    /**
+     * Acquisitions each thread makes
+     */
+    unsigned long acquisitions;
+    /**
+     * Time spent holding the lock on each acquisition
+     */
+    uint64_t hold_ns;
+    /**
+     * Time spent outside the lock between acquisitions
+     */
+    uint64_t wait_ns;
+};
+
+struct contention_result
+{
+    uint64_t acquisitions;
+    uint64_t elapsed_ns;
+    double acquisitions_per_sec;
+    /**
+     * Acquisition latency percentiles, from the call of lock_acquire until it returned
+     */
+    uint64_t latency_p50_ns;
+    uint64_t latency_p90_ns;
+    uint64_t latency_p99_ns;
+    uint64_t latency_max_ns;
+};
+
+/**
+ * Runs @param config and fills @param result
+ * @return 0 on success or an errno value
+ */
+int contention_run(const struct contention_config *config, struct contention_result *result);
+
+#endif /* THREADING_CONTENTION_H */
@@ -0,0 +1,203 @@
+#include "lock.h"
+#include <errno.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Spins a ticket lock waiter makes before it yields the CPU to the holder */
+#define TICKET_SPINS_BEFORE_YIELD 128
+/* Longest an adaptive lock spins before sleeping */
+#define ADAPTIVE_MAX_SPIN 1000
+
+static const char *const kind_names[LOCK_KIND_COUNT] = {
+    [LOCK_MUTEX] = "mutex",
+    [LOCK_SPIN] = "spin",
+    [LOCK_TICKET] = "ticket",
+    [LOCK_ADAPTIVE] = "adaptive",
+};
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static void futex_wait(atomic_uint *addr, unsigned int val)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake_one(atomic_uint *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+int lock_init(struct lock *lock, enum lock_kind kind)
+{
+    long cpus;
+
+    memset(lock, 0, sizeof(*lock));
+    lock->kind = kind;
+    switch (kind)
+    {
+    case LOCK_MUTEX:
+        return pthread_mutex_init(&lock->u.mutex, NULL);
+    case LOCK_SPIN:
+        return pthread_spin_init(&lock->u.spin, PTHREAD_PROCESS_PRIVATE);
+    case LOCK_TICKET:
+        return 0;
+    case LOCK_ADAPTIVE:
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        lock->u.adaptive.max_spin = cpus > 1 ? ADAPTIVE_MAX_SPIN : 0;
+        return 0;
+    default:
+        return EINVAL;
+    }
+}
+
+void lock_destroy(struct lock *lock)
+{
+    if (lock->kind == LOCK_MUTEX)
+    {
+        pthread_mutex_destroy(&lock->u.mutex);
+    }
+    else if (lock->kind == LOCK_SPIN)
+    {
+        pthread_spin_destroy(&lock->u.spin);
+    }
+}
+
+static void ticket_acquire(struct lock *lock)
+{
+    unsigned int ticket = atomic_fetch_add_explicit(&lock->u.ticket.next, 1, memory_order_relaxed);
+    unsigned int spins = 0;
+
+    while (atomic_load_explicit(&lock->u.ticket.serving, memory_order_acquire) != ticket)
+    {
+        // a waiter which keeps spinning while the holder or the next in line is
+        // preempted only delays them, so give the CPU away now and then
+        if (++spins % TICKET_SPINS_BEFORE_YIELD == 0)
+        {
+            sched_yield();
+        }
+        else
+        {
+            cpu_relax();
+        }
+    }
+}
+
+static void ticket_release(struct lock *lock)
+{
+    unsigned int serving = atomic_load_explicit(&lock->u.ticket.serving, memory_order_relaxed);
+
+    atomic_store_explicit(&lock->u.ticket.serving, serving + 1, memory_order_release);
+}
+
+/*
+ * The futex lock from Drepper's "Futexes Are Tricky", with a spin phase in front.  The
+ * spin budget follows twice the average number of spins successful acquisitions
+ * needed, like glibc's PTHREAD_MUTEX_ADAPTIVE_NP, so a lock held for long stops
+ * wasting CPU on spinning and a briefly held one rarely sleeps.
+ */
+static void adaptive_acquire(struct lock *lock)
+{
+    unsigned int expected = 0;
+    unsigned int avg;
+    unsigned int budget;
+    unsigned int spins;
+    unsigned int state;
+
+    if (atomic_compare_exchange_strong_explicit(&lock->u.adaptive.state, &expected, 1,
+            memory_order_acquire, memory_order_relaxed))
+    {
+        return;
+    }
+    avg = atomic_load_explicit(&lock->u.adaptive.spin_avg, memory_order_relaxed);
+    budget = avg / 4 + 16;
+    if (budget > lock->u.adaptive.max_spin)
+    {
+        budget = lock->u.adaptive.max_spin;
+    }
+    for (spins = 0; spins < budget; spins++)
+    {
+        cpu_relax();
+        expected = 0;
+        if (atomic_load_explicit(&lock->u.adaptive.state, memory_order_relaxed) == 0 &&
+            atomic_compare_exchange_weak_explicit(&lock->u.adaptive.state, &expected, 1,
+                memory_order_acquire, memory_order_relaxed))
+        {
+            // avg += (spins - avg) / 8, kept in eighths of a spin
+            atomic_store_explicit(&lock->u.adaptive.spin_avg, avg + spins - avg / 8,
+                    memory_order_relaxed);
+            return;
+        }
+    }
+    if (budget > 0)
+    {
+        atomic_store_explicit(&lock->u.adaptive.spin_avg, avg + budget - avg / 8, memory_order_relaxed);
+    }
+    // mark the lock contended, so the holder knows to wake a sleeper on release
+    state = atomic_exchange_explicit(&lock->u.adaptive.state, 2, memory_order_acquire);
+    while (state != 0)
+    {
+        futex_wait(&lock->u.adaptive.state, 2);
+        state = atomic_exchange_explicit(&lock->u.adaptive.state, 2, memory_order_acquire);
+    }
+}
+
+static void adaptive_release(struct lock *lock)
+{
+    if (atomic_exchange_explicit(&lock->u.adaptive.state, 0, memory_order_release) == 2)
+    {
+        futex_wake_one(&lock->u.adaptive.state);
+    }
+}
+
+void lock_acquire(struct lock *lock)
+{
+    switch (lock->kind)
+    {
+    case LOCK_MUTEX:
+        pthread_mutex_lock(&lock->u.mutex);
+        break;
+    case LOCK_SPIN:
+        pthread_spin_lock(&lock->u.spin);
+        break;
+    case LOCK_TICKET:
+        ticket_acquire(lock);
+        break;
+    default:
+        adaptive_acquire(lock);
+        break;
+    }
+}
+
+void lock_release(struct lock *lock)
+{
+    switch (lock->kind)
+    {
+    case LOCK_MUTEX:
+        pthread_mutex_unlock(&lock->u.mutex);
+        break;
+    case LOCK_SPIN:
+        pthread_spin_unlock(&lock->u.spin);
+        break;
+    case LOCK_TICKET:
+        ticket_release(lock);
+        break;
+    default:
+        adaptive_release(lock);
+        break;
+    }
+}
+
+const char *lock_kind_name(enum lock_kind kind)
+{
+    return kind >= 0 && kind < LOCK_KIND_COUNT ? kind_names[kind] : "unknown";
+}
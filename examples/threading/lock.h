@@ -0,0 +1,74 @@
+/*
+ * lock.h
+ *
+ * Interchangeable locks for comparing how they behave under contention, see
+ * contention.h.  A struct lock wraps one of:
+ *   LOCK_MUTEX     a default pthread mutex
+ *   LOCK_SPIN      a pthread spinlock, which never sleeps
+ *   LOCK_TICKET    a FIFO ticket lock, which spins and yields the CPU while it waits
+ *   LOCK_ADAPTIVE  a futex lock which first spins for as long as recent acquisitions
+ *                  needed, then sleeps in the kernel until the holder wakes it
+ */
+
+#ifndef THREADING_LOCK_H
+#define THREADING_LOCK_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+enum lock_kind
+{
+    LOCK_MUTEX,
+    LOCK_SPIN,
+    LOCK_TICKET,
+    LOCK_ADAPTIVE,
+    LOCK_KIND_COUNT
+};
+
+struct lock
+{
+    enum lock_kind kind;
+    union
+    {
+        pthread_mutex_t mutex;
+        pthread_spinlock_t spin;
+        struct
+        {
+            atomic_uint next;
+            atomic_uint serving;
+        } ticket;
+        struct
+        {
+            /**
+             * 0 unlocked, 1 locked, 2 locked with sleeping waiters
+             */
+            atomic_uint state;
+            /**
+             * Moving average of the spins recent acquisitions needed, in spins * 8
+             */
+            atomic_uint spin_avg;
+            /**
+             * Upper bound for spinning, 0 on a single CPU where spinning cannot help
+             */
+            unsigned int max_spin;
+        } adaptive;
+    } u;
+};
+
+/**
+ * @return 0 on success or an errno value
+ */
+int lock_init(struct lock *lock, enum lock_kind kind);
+
+void lock_destroy(struct lock *lock);
+
+void lock_acquire(struct lock *lock);
+
+void lock_release(struct lock *lock);
+
+/**
+ * @return a short name for @param kind, "mutex", "spin", "ticket" or "adaptive"
+ */
+const char *lock_kind_name(enum lock_kind kind);
+
+#endif /* THREADING_LOCK_H */
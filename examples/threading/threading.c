@@ -14,10 +14,10 @@ void *threadfunc(void *thread_param)
     int hold = thread_args->wait_to_release_ms;
     pthread_mutex_t *mutx = thread_args->mutex;
 
-    // perform ops
-    usleep(wait);
+    // perform ops, usleep takes microseconds
+    usleep(wait * 1000);
     pthread_mutex_lock(mutx);
-    usleep(hold);
+    usleep(hold * 1000);
     pthread_mutex_unlock(mutx);
     thread_args->thread_complete_success = true;
     return thread_param;
@@ -42,11 +42,14 @@ bool start_thread_obtaining_mutex(
     thread_param->wait_to_obtain_ms = wait_to_obtain_ms;
     thread_param->wait_to_release_ms = wait_to_release_ms;
     thread_param->mutex = mutex;
+    thread_param->thread_complete_success = false;
 
-    // exec
+    // exec, on success the joiner owns thread_param
     if (pthread_create(thread, NULL, threadfunc, (void *)thread_param) == 0)
     {
         return true;
     }
+    ERROR_LOG("pthread_create failed");
+    free(thread_param);
     return false;
 }
@@ -9,4 +9,11 @@ struct thread_data
     bool thread_complete_success;
 };
 
+/**
+ * Starts a thread which waits @param wait_to_obtain_ms milliseconds, locks @param mutex,
+ * holds it for @param wait_to_release_ms milliseconds and unlocks it.
+ * The thread returns its malloc'd struct thread_data, which the caller of pthread_join
+ * must free.  Nothing is left to free when this returns false.
+ * @return true if the thread was started
+ */
 bool start_thread_obtaining_mutex(pthread_t *thread, pthread_mutex_t *mutex, int wait_to_obtain_ms, int wait_to_release_ms);
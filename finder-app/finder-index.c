@@ -0,0 +1,427 @@
+/**
+ * finder-index: the persistent trigram index behind finder -i, see finder-index.h
+ *
+ * File layout, in host byte order since the index is only read on the machine which
+ * wrote it:
+ *   struct index_header, then the root path and a NUL, padded to 8 bytes
+ *   for every entry, sorted by path:
+ *     struct index_record, then the path and a NUL, padded to 8 bytes, then ntrigrams
+ *     uint32_t trigrams in ascending order, padded to 8 bytes
+ */
+
+#define _GNU_SOURCE
+#include "finder-index.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define INDEX_MAGIC "FNDRIDX\0"
+#define INDEX_VERSION 2
+#define TRIGRAM_SPACE (1u << 24)
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+struct index_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t root_len;
+    uint64_t count;
+};
+
+struct index_record
+{
+    uint64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    uint64_t ino;
+    uint32_t flags;
+    uint32_t path_len;
+    uint32_t ntrigrams;
+    uint32_t reserved;
+};
+
+static int compare_entries(const void *a, const void *b)
+{
+    return strcmp(((const struct finder_index_entry *)a)->path, ((const struct finder_index_entry *)b)->path);
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static int64_t timespec_ns(const struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+/**
+ * Parses the mapped index into index->entries
+ * @return 0 if the mapping is a valid index for @param root, 1 if not, -1 if out of memory
+ */
+static int parse_index(struct finder_index *index, const char *root)
+{
+    const char *base = index->map;
+    const struct index_header *header = index->map;
+    size_t root_len = strlen(root);
+    size_t offset;
+    size_t i;
+
+    if (index->map_size < sizeof(*header) || memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != INDEX_VERSION || header->root_len != root_len)
+    {
+        return 1;
+    }
+    offset = sizeof(*header);
+    if (index->map_size - offset < root_len + 1 || memcmp(base + offset, root, root_len + 1) != 0)
+    {
+        return 1;
+    }
+    offset = ALIGN_UP(offset + root_len + 1, 8);
+    // every record takes at least its fixed part, which bounds a corrupt count
+    if (header->count > index->map_size / sizeof(struct index_record))
+    {
+        return 1;
+    }
+    index->entries = calloc(header->count > 0 ? header->count : 1, sizeof(*index->entries));
+    if (index->entries == NULL)
+    {
+        return -1;
+    }
+    for (i = 0; i < header->count; i++)
+    {
+        const struct index_record *record = (const struct index_record *)(base + offset);
+        struct finder_index_entry *entry = &index->entries[i];
+
+        if (offset > index->map_size || index->map_size - offset < sizeof(*record))
+        {
+            return 1;
+        }
+        offset += sizeof(*record);
+        if (index->map_size - offset < (size_t)record->path_len + 1 || base[offset + record->path_len] != '\0')
+        {
+            return 1;
+        }
+        entry->path = base + offset;
+        offset = ALIGN_UP(offset + record->path_len + 1, 8);
+        if (record->ntrigrams > FINDER_INDEX_MAX_TRIGRAMS || offset > index->map_size ||
+            (index->map_size - offset) / sizeof(uint32_t) < record->ntrigrams)
+        {
+            return 1;
+        }
+        entry->trigrams = (const uint32_t *)(base + offset);
+        entry->ntrigrams = record->ntrigrams;
+        offset = ALIGN_UP(offset + record->ntrigrams * sizeof(uint32_t), 8);
+        entry->size = record->size;
+        entry->mtime_ns = record->mtime_ns;
+        entry->ctime_ns = record->ctime_ns;
+        entry->ino = record->ino;
+        entry->flags = record->flags & ~FINDER_INDEX_OWNED;
+        if (i > 0 && strcmp(index->entries[i - 1].path, entry->path) >= 0)
+        {
+            return 1;
+        }
+    }
+    index->count = header->count;
+    return 0;
+}
+
+int finder_index_load(struct finder_index *index, const char *path, const char *root)
+{
+    struct stat st;
+    int fd;
+    int rc;
+
+    memset(index, 0, sizeof(*index));
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return errno == ENOENT ? 0 : -1;
+    }
+    if (fstat(fd, &st) == -1 || st.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+    index->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (index->map == MAP_FAILED)
+    {
+        index->map = NULL;
+        return -1;
+    }
+    index->map_size = st.st_size;
+    rc = parse_index(index, root);
+    if (rc != 0)
+    {
+        // a stale or foreign index is rebuilt from scratch
+        finder_index_release(index);
+    }
+    return rc < 0 ? -1 : 0;
+}
+
+void finder_index_release(struct finder_index *index)
+{
+    free(index->entries);
+    if (index->map != NULL)
+    {
+        munmap(index->map, index->map_size);
+    }
+    memset(index, 0, sizeof(*index));
+}
+
+const struct finder_index_entry *finder_index_lookup(const struct finder_index *index, const char *path)
+{
+    struct finder_index_entry key = { .path = path };
+
+    if (index->count == 0)
+    {
+        return NULL;
+    }
+    return bsearch(&key, index->entries, index->count, sizeof(*index->entries), compare_entries);
+}
+
+bool finder_index_entry_current(const struct finder_index_entry *entry, const struct stat *st)
+{
+    // ctime also moves on writes which restore the mtime, such as from tar or touch -r
+    return entry->size == (uint64_t)st->st_size && entry->mtime_ns == timespec_ns(&st->st_mtim) &&
+           entry->ctime_ns == timespec_ns(&st->st_ctim) && entry->ino == st->st_ino;
+}
+
+static inline uint32_t trigram_at(const char *p)
+{
+    return (uint32_t)(unsigned char)p[0] << 16 | (uint32_t)(unsigned char)p[1] << 8 | (unsigned char)p[2];
+}
+
+int finder_index_entry_build(struct finder_index_entry *entry, const char *path, const struct stat *st,
+                             const char *data, size_t size, struct finder_index_scratch *scratch)
+{
+    size_t count = 0;
+    size_t i;
+    uint32_t *trigrams = NULL;
+
+    memset(entry, 0, sizeof(*entry));
+    entry->path = strdup(path);
+    if (entry->path == NULL)
+    {
+        return -1;
+    }
+    entry->size = st->st_size;
+    entry->mtime_ns = timespec_ns(&st->st_mtim);
+    entry->ctime_ns = timespec_ns(&st->st_ctim);
+    entry->ino = st->st_ino;
+    entry->flags = FINDER_INDEX_OWNED;
+    // binary files keep their trigrams too, so a search still finds them to report
+    if (size > 0 && memchr(data, '\0', size) != NULL)
+    {
+        entry->flags |= FINDER_INDEX_BINARY;
+    }
+    if (scratch->seen == NULL)
+    {
+        scratch->seen = calloc(TRIGRAM_SPACE / 64, sizeof(*scratch->seen));
+        if (scratch->seen == NULL)
+        {
+            return -1;
+        }
+    }
+    for (i = 0; i + 3 <= size; i++)
+    {
+        // a needle never spans lines, so trigrams across a newline are never looked up
+        if (data[i + 2] == '\n')
+        {
+            i += 2;
+            continue;
+        }
+        if (data[i + 1] == '\n')
+        {
+            i += 1;
+            continue;
+        }
+        if (data[i] == '\n')
+        {
+            continue;
+        }
+        uint32_t trigram = trigram_at(data + i);
+        uint64_t bit = 1ull << (trigram & 63);
+        if (scratch->seen[trigram >> 6] & bit)
+        {
+            continue;
+        }
+        if (count == FINDER_INDEX_MAX_TRIGRAMS)
+        {
+            entry->flags |= FINDER_INDEX_UNFILTERED;
+            break;
+        }
+        if (count == scratch->capacity)
+        {
+            size_t capacity = scratch->capacity == 0 ? 4096 : scratch->capacity * 2;
+            uint32_t *grown = realloc(scratch->trigrams, capacity * sizeof(*grown));
+            if (grown == NULL)
+            {
+                entry->flags |= FINDER_INDEX_UNFILTERED;
+                break;
+            }
+            scratch->trigrams = grown;
+            scratch->capacity = capacity;
+        }
+        scratch->seen[trigram >> 6] |= bit;
+        scratch->trigrams[count++] = trigram;
+    }
+    // clear only the bits this file set, the bitmap is 2MB
+    for (i = 0; i < count; i++)
+    {
+        scratch->seen[scratch->trigrams[i] >> 6] = 0;
+    }
+    if (entry->flags & FINDER_INDEX_UNFILTERED || count == 0)
+    {
+        return 0;
+    }
+    trigrams = malloc(count * sizeof(*trigrams));
+    if (trigrams == NULL)
+    {
+        entry->flags |= FINDER_INDEX_UNFILTERED;
+        return 0;
+    }
+    memcpy(trigrams, scratch->trigrams, count * sizeof(*trigrams));
+    qsort(trigrams, count, sizeof(*trigrams), compare_u32);
+    entry->trigrams = trigrams;
+    entry->ntrigrams = count;
+    return 0;
+}
+
+void finder_index_entry_release(struct finder_index_entry *entry)
+{
+    if (entry->flags & FINDER_INDEX_OWNED)
+    {
+        free((char *)entry->path);
+        free((uint32_t *)entry->trigrams);
+    }
+    memset(entry, 0, sizeof(*entry));
+}
+
+void finder_index_scratch_release(struct finder_index_scratch *scratch)
+{
+    free(scratch->seen);
+    free(scratch->trigrams);
+    memset(scratch, 0, sizeof(*scratch));
+}
+
+size_t finder_index_needle_trigrams(const char *needle, size_t len, uint32_t *trigrams)
+{
+    size_t i;
+
+    if (len < 3)
+    {
+        return 0;
+    }
+    for (i = 0; i + 3 <= len; i++)
+    {
+        trigrams[i] = trigram_at(needle + i);
+    }
+    return i;
+}
+
+bool finder_index_entry_may_match(const struct finder_index_entry *entry, const uint32_t *trigrams,
+                                  size_t ntrigrams)
+{
+    size_t i;
+
+    if (entry->flags & FINDER_INDEX_UNFILTERED || ntrigrams == 0)
+    {
+        return true;
+    }
+    if (entry->ntrigrams == 0)
+    {
+        return false;
+    }
+    for (i = 0; i < ntrigrams; i++)
+    {
+        if (bsearch(&trigrams[i], entry->trigrams, entry->ntrigrams, sizeof(*entry->trigrams), compare_u32) == NULL)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int write_padded(FILE *fp, const void *buf, size_t len, size_t align)
+{
+    static const char zeros[8];
+    size_t pad = ALIGN_UP(len, align) - len;
+
+    if (len == 0)
+    {
+        return 0;
+    }
+    return fwrite(buf, 1, len, fp) == len && fwrite(zeros, 1, pad, fp) == pad ? 0 : -1;
+}
+
+int finder_index_save(const char *path, const char *root, struct finder_index_entry *entries, size_t count)
+{
+    struct index_header header = { .magic = INDEX_MAGIC, .version = INDEX_VERSION };
+    char *tmp_path;
+    FILE *fp;
+    size_t i;
+    int rc = 0;
+
+    if (asprintf(&tmp_path, "%s.tmp.%d", path, (int)getpid()) == -1)
+    {
+        return -1;
+    }
+    fp = fopen(tmp_path, "we");
+    if (fp == NULL)
+    {
+        free(tmp_path);
+        return -1;
+    }
+    qsort(entries, count, sizeof(*entries), compare_entries);
+    header.root_len = strlen(root);
+    header.count = count;
+    if (fwrite(&header, sizeof(header), 1, fp) != 1 || write_padded(fp, root, header.root_len + 1, 8) != 0)
+    {
+        rc = -1;
+    }
+    for (i = 0; i < count && rc == 0; i++)
+    {
+        const struct finder_index_entry *entry = &entries[i];
+        struct index_record record = {
+            .size = entry->size,
+            .mtime_ns = entry->mtime_ns,
+            .ctime_ns = entry->ctime_ns,
+            .ino = entry->ino,
+            .flags = entry->flags & ~FINDER_INDEX_OWNED,
+            .path_len = strlen(entry->path),
+            .ntrigrams = entry->ntrigrams,
+        };
+
+        if (fwrite(&record, sizeof(record), 1, fp) != 1 ||
+            write_padded(fp, entry->path, record.path_len + 1, 8) != 0 ||
+            write_padded(fp, entry->trigrams, entry->ntrigrams * sizeof(uint32_t), 8) != 0)
+        {
+            rc = -1;
+        }
+    }
+    if (fclose(fp) != 0)
+    {
+        rc = -1;
+    }
+    if (rc == 0 && rename(tmp_path, path) != 0)
+    {
+        rc = -1;
+    }
+    if (rc != 0)
+    {
+        int saved_errno = errno;
+        unlink(tmp_path);
+        errno = saved_errno;
+    }
+    free(tmp_path);
+    return rc;
+}
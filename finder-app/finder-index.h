@@ -0,0 +1,118 @@
+/**
+ * finder-index: the persistent trigram index behind finder -i
+ *
+ * The index records every regular file finder found under a filesdir, with the size,
+ * mtime, ctime and inode it had when it was read, whether it is binary, and the sorted
+ * set of distinct three byte sequences, trigrams, in its lines.  A file whose stat still
+ * agrees with its entry does not have to be read to learn that it cannot contain a
+ * search string: a string of three or more bytes can only occur in a file containing
+ * every trigram of the string.  Only the remaining candidates are read and searched.
+ *
+ * The index is a single file which is mmap'd when loaded, so entries of unchanged files
+ * point into the mapping.  It is rewritten through a temporary file and rename, which
+ * leaves the mapping of the previous version valid until it is released.
+ */
+
+#ifndef FINDER_INDEX_H
+#define FINDER_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/* The file contains a NUL byte, so finder reports its matches without counting its lines */
+#define FINDER_INDEX_BINARY 0x1
+/* The file has more than FINDER_INDEX_MAX_TRIGRAMS trigrams and is always a candidate */
+#define FINDER_INDEX_UNFILTERED 0x2
+/* trigrams was malloc'd by finder_index_entry_build rather than mapped */
+#define FINDER_INDEX_OWNED 0x80000000
+
+#define FINDER_INDEX_MAX_TRIGRAMS (1 << 18)
+
+struct finder_index_entry
+{
+    const char *path;
+    uint64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    uint64_t ino;
+    uint32_t flags;
+    uint32_t ntrigrams;
+    const uint32_t *trigrams;
+};
+
+struct finder_index
+{
+    /**
+     * Sorted by path
+     */
+    struct finder_index_entry *entries;
+    size_t count;
+    void *map;
+    size_t map_size;
+};
+
+/**
+ * Per thread scratch space for finder_index_entry_build
+ */
+struct finder_index_scratch
+{
+    /**
+     * One bit per possible trigram, all clear between builds
+     */
+    uint64_t *seen;
+    uint32_t *trigrams;
+    size_t capacity;
+};
+
+/**
+ * Loads the index at @param path if it exists and was built for @param root, else leaves
+ * @param index empty
+ * @return 0 on success, including a missing or unusable index, -1 on errors such as memory
+ */
+int finder_index_load(struct finder_index *index, const char *path, const char *root);
+
+void finder_index_release(struct finder_index *index);
+
+const struct finder_index_entry *finder_index_lookup(const struct finder_index *index, const char *path);
+
+/**
+ * @return true if @param st still describes the file @param entry was built from
+ */
+bool finder_index_entry_current(const struct finder_index_entry *entry, const struct stat *st);
+
+/**
+ * Builds the entry for the contents @param data of @param path, described by @param st.
+ * The entry's path is a malloc'd copy and its trigrams are malloc'd.
+ * @return 0 on success, -1 if out of memory
+ */
+int finder_index_entry_build(struct finder_index_entry *entry, const char *path, const struct stat *st,
+                             const char *data, size_t size, struct finder_index_scratch *scratch);
+
+/**
+ * Releases what finder_index_entry_build allocated, nothing for mapped entries
+ */
+void finder_index_entry_release(struct finder_index_entry *entry);
+
+void finder_index_scratch_release(struct finder_index_scratch *scratch);
+
+/**
+ * @return the number of trigrams of @param needle written to @param trigrams, which holds
+ * at least @param len entries; 0 when the needle is too short to filter by
+ */
+size_t finder_index_needle_trigrams(const char *needle, size_t len, uint32_t *trigrams);
+
+/**
+ * @return false if the file of @param entry cannot contain a needle with @param trigrams
+ */
+bool finder_index_entry_may_match(const struct finder_index_entry *entry, const uint32_t *trigrams,
+                                  size_t ntrigrams);
+
+/**
+ * Writes @param count @param entries, in any order, as the index of @param root at @param path
+ * @return 0 on success, -1 with errno set
+ */
+int finder_index_save(const char *path, const char *root, struct finder_index_entry *entries, size_t count);
+
+#endif /* FINDER_INDEX_H */
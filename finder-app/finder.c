@@ -0,0 +1,871 @@
+/**
+ * finder: a single pass replacement for finder.sh
+ *
+ * Usage: finder [-i index] <filesdir> <searchstr>
+ * Prints "The number of files are X and the number of matching lines are Y" like
+ * finder.sh, where X counts the files grep -R would list under filesdir and Y the
+ * lines of grep -R output, but reads every file once instead of twice.
+ *
+ * The tree is walked by a pool of threads.  Each thread owns a deque of directories and
+ * files still to be read; it works from the back of its own deque and, when that is
+ * empty, steals from the front of another thread's deque, so one huge directory is
+ * spread over all threads.  Files are mmap'd and searched with an SSE2 substring search
+ * where available, memmem otherwise.
+ *
+ * Like grep -R, symbolic links are followed, a directory which links back to one of its
+ * ancestors is skipped, and a file containing a NUL byte is binary: its matches are
+ * reported on stderr and not counted, as GNU grep 3.5 and later print "binary file
+ * matches" to stderr.  searchstr is matched as a literal string.
+ *
+ * With -i, finder keeps a trigram index of filesdir in the index file, which must lie
+ * outside filesdir, see finder-index.h.  Files whose size, mtime, ctime and inode match
+ * their entry are only read when their trigrams allow a match; other files are read,
+ * searched and re-indexed, and the index is rewritten when anything changed.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "finder-index.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define MAX_FINDER_THREADS 64
+#define DEQUE_INITIAL_CAPACITY 64
+/* How long an idle thread sleeps before looking for work again, unless woken earlier */
+#define IDLE_WAIT_NS 1000000
+
+/**
+ * A directory being walked, kept while any of its entries is queued so descendants can
+ * check their ancestors for symbolic link loops
+ */
+struct dir_node
+{
+    dev_t dev;
+    ino_t ino;
+    struct dir_node *parent;
+    atomic_int refcount;
+};
+
+struct work_item
+{
+    char *path;
+    bool is_dir;
+    /**
+     * The directory path was found in, NULL for filesdir itself
+     */
+    struct dir_node *parent;
+};
+
+struct work_deque
+{
+    pthread_mutex_t lock;
+    struct work_item *items;
+    size_t head;
+    size_t count;
+    size_t capacity;
+};
+
+struct worker
+{
+    struct finder *finder;
+    pthread_t thread;
+    int index;
+    struct work_deque deque;
+    unsigned long files;
+    unsigned long lines;
+    /**
+     * Index entries for the files this worker found, with -i
+     */
+    struct finder_index_entry *entries;
+    size_t nentries;
+    size_t entries_capacity;
+    /**
+     * Entries built from file contents rather than taken over from the loaded index
+     */
+    size_t rebuilt;
+    struct finder_index_scratch scratch;
+};
+
+struct finder
+{
+    const char *needle;
+    size_t needle_len;
+    struct worker *workers;
+    int nworkers;
+    /**
+     * Items queued or being processed, the walk is complete when it drops to 0
+     */
+    atomic_size_t pending;
+    atomic_int idle;
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    /**
+     * With -i, the index as loaded and the trigrams of the needle
+     */
+    bool indexing;
+    struct finder_index index;
+    uint32_t *needle_trigrams;
+    size_t needle_ntrigrams;
+    /**
+     * Length of the filesdir prefix of walked paths, index entries are relative to it
+     */
+    size_t root_len;
+};
+
+static void dir_node_put(struct dir_node *node)
+{
+    while (node != NULL && atomic_fetch_sub(&node->refcount, 1) == 1)
+    {
+        struct dir_node *parent = node->parent;
+        free(node);
+        node = parent;
+    }
+}
+
+static bool deque_push(struct work_deque *deque, const struct work_item *item)
+{
+    bool ok = true;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count == deque->capacity)
+    {
+        size_t capacity = deque->capacity == 0 ? DEQUE_INITIAL_CAPACITY : deque->capacity * 2;
+        struct work_item *items = malloc(capacity * sizeof(*items));
+        size_t i;
+
+        if (items == NULL)
+        {
+            ok = false;
+        }
+        else
+        {
+            for (i = 0; i < deque->count; i++)
+            {
+                items[i] = deque->items[(deque->head + i) % deque->capacity];
+            }
+            free(deque->items);
+            deque->items = items;
+            deque->head = 0;
+            deque->capacity = capacity;
+        }
+    }
+    if (ok)
+    {
+        deque->items[(deque->head + deque->count) % deque->capacity] = *item;
+        deque->count++;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return ok;
+}
+
+/* The owner takes the newest item, depth first, which keeps its working set small */
+static bool deque_pop_back(struct work_deque *deque, struct work_item *item_rtn)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0)
+    {
+        deque->count--;
+        *item_rtn = deque->items[(deque->head + deque->count) % deque->capacity];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+/* Thieves take the oldest item, usually a directory high in the tree with much work below */
+static bool deque_steal_front(struct work_deque *deque, struct work_item *item_rtn)
+{
+    bool found = false;
+
+    if (pthread_mutex_trylock(&deque->lock) != 0)
+    {
+        return false;
+    }
+    if (deque->count > 0)
+    {
+        *item_rtn = deque->items[deque->head];
+        deque->head = (deque->head + 1) % deque->capacity;
+        deque->count--;
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static void queue_work(struct worker *self, char *path, bool is_dir, struct dir_node *parent)
+{
+    struct finder *finder = self->finder;
+    struct work_item item = { .path = path, .is_dir = is_dir, .parent = parent };
+
+    if (parent != NULL)
+    {
+        atomic_fetch_add(&parent->refcount, 1);
+    }
+    atomic_fetch_add(&finder->pending, 1);
+    if (!deque_push(&self->deque, &item))
+    {
+        perror("finder: malloc");
+        atomic_fetch_sub(&finder->pending, 1);
+        dir_node_put(parent);
+        free(path);
+        return;
+    }
+    if (atomic_load(&finder->idle) > 0)
+    {
+        pthread_mutex_lock(&finder->idle_lock);
+        pthread_cond_signal(&finder->idle_cond);
+        pthread_mutex_unlock(&finder->idle_lock);
+    }
+}
+
+static const char *search(const char *hay, size_t len, const char *needle, size_t needle_len)
+{
+    if (needle_len == 0)
+    {
+        return hay;
+    }
+    if (needle_len == 1)
+    {
+        return memchr(hay, needle[0], len);
+    }
+#ifdef __SSE2__
+    /*
+     * Compare 16 positions at once against the first and the last byte of the needle and
+     * only memcmp the positions where both agree, which rejects almost every position in
+     * ordinary text without a byte by byte loop
+     */
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+    size_t i = 0;
+
+    for (; i + needle_len - 1 + 16 <= len; i += 16)
+    {
+        __m128i block_first = _mm_loadu_si128((const __m128i *)(hay + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i *)(hay + i + needle_len - 1));
+        unsigned int mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+
+        while (mask != 0)
+        {
+            unsigned int bit = __builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, needle_len - 2) == 0)
+            {
+                return hay + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return i < len ? memmem(hay + i, len - i, needle, needle_len) : NULL;
+#else
+    return memmem(hay, len, needle, needle_len);
+#endif
+}
+
+/**
+ * @return the number of lines of the file contents containing the needle
+ * @param binary_rtn set when the contents are binary, where the count stops at 1
+ */
+static unsigned long count_matching_lines(const struct finder *finder, const char *data, size_t size,
+                                          bool *binary_rtn)
+{
+    const char *end = data + size;
+    const char *p = data;
+    const char *match;
+    const char *newline;
+    unsigned long lines = 0;
+    bool binary = memchr(data, '\0', size) != NULL;
+
+    *binary_rtn = binary;
+    while (p < end && (match = search(p, end - p, finder->needle, finder->needle_len)) != NULL)
+    {
+        if (binary)
+        {
+            return 1;
+        }
+        lines++;
+        // the rest of the matching line cannot add another line
+        newline = memchr(match, '\n', end - match);
+        p = newline != NULL ? newline + 1 : end;
+    }
+    return lines;
+}
+
+static void add_matching_lines(struct worker *self, const char *path, const char *data, size_t size)
+{
+    bool binary;
+    unsigned long lines;
+
+    if (size == 0)
+    {
+        return;
+    }
+    lines = count_matching_lines(self->finder, data, size, &binary);
+    if (!binary)
+    {
+        self->lines += lines;
+    }
+    else if (lines > 0)
+    {
+        fprintf(stderr, "finder: %s: binary file matches\n", path);
+    }
+}
+
+/**
+ * @return the malloc'd contents of @param fd read up to end of file, NULL if empty or on error
+ */
+static char *read_all(int fd, size_t *size_rtn)
+{
+    char *data = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    ssize_t n;
+
+    for (;;)
+    {
+        if (size == capacity)
+        {
+            char *grown = realloc(data, capacity == 0 ? 4096 : capacity * 2);
+            if (grown == NULL)
+            {
+                break;
+            }
+            data = grown;
+            capacity = capacity == 0 ? 4096 : capacity * 2;
+        }
+        n = read(fd, data + size, capacity - size);
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        size += n;
+    }
+    if (size == 0)
+    {
+        free(data);
+        return NULL;
+    }
+    *size_rtn = size;
+    return data;
+}
+
+/**
+ * The contents of a regular file, mapped, or read for files like those in /proc which
+ * report a size of 0 but still have contents
+ */
+struct file_contents
+{
+    struct stat st;
+    char *data;
+    size_t size;
+    bool mapped;
+};
+
+/**
+ * @return 0 with @param contents filled, -1 if @param path is unreadable or, like grep -R
+ * skips them, a device, fifo or socket
+ */
+static int open_contents(const char *path, struct file_contents *contents)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+
+    memset(contents, 0, sizeof(*contents));
+    if (fd == -1)
+    {
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &contents->st) == -1 || !S_ISREG(contents->st.st_mode))
+    {
+        close(fd);
+        return -1;
+    }
+    if (contents->st.st_size > 0)
+    {
+        contents->data = mmap(NULL, contents->st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (contents->data == MAP_FAILED)
+        {
+            fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+            contents->data = NULL;
+        }
+        else
+        {
+            madvise(contents->data, contents->st.st_size, MADV_SEQUENTIAL);
+            contents->size = contents->st.st_size;
+            contents->mapped = true;
+        }
+    }
+    else
+    {
+        contents->data = read_all(fd, &contents->size);
+    }
+    close(fd);
+    return 0;
+}
+
+static void release_contents(struct file_contents *contents)
+{
+    if (contents->mapped)
+    {
+        munmap(contents->data, contents->size);
+    }
+    else
+    {
+        free(contents->data);
+    }
+}
+
+static bool add_entry(struct worker *self, const struct finder_index_entry *entry)
+{
+    if (self->nentries == self->entries_capacity)
+    {
+        size_t capacity = self->entries_capacity == 0 ? 256 : self->entries_capacity * 2;
+        struct finder_index_entry *entries = realloc(self->entries, capacity * sizeof(*entries));
+        if (entries == NULL)
+        {
+            return false;
+        }
+        self->entries = entries;
+        self->entries_capacity = capacity;
+    }
+    self->entries[self->nentries++] = *entry;
+    return true;
+}
+
+static void process_file_indexed(struct worker *self, const char *path)
+{
+    struct finder *finder = self->finder;
+    const char *relpath = path + finder->root_len + (path[finder->root_len] == '/');
+    const struct finder_index_entry *entry;
+    struct finder_index_entry built;
+    struct file_contents contents;
+    struct stat st;
+
+    if (stat(path, &st) == -1)
+    {
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+        return;
+    }
+    if (!S_ISREG(st.st_mode))
+    {
+        return;
+    }
+    entry = finder_index_lookup(&finder->index, relpath);
+    if (entry != NULL && finder_index_entry_current(entry, &st) && access(path, R_OK) == 0)
+    {
+        self->files++;
+        if (!add_entry(self, entry))
+        {
+            perror("finder: malloc");
+        }
+        if (finder_index_entry_may_match(entry, finder->needle_trigrams, finder->needle_ntrigrams) &&
+            open_contents(path, &contents) == 0)
+        {
+            add_matching_lines(self, path, contents.data, contents.size);
+            release_contents(&contents);
+        }
+        return;
+    }
+    if (open_contents(path, &contents) != 0)
+    {
+        return;
+    }
+    self->files++;
+    add_matching_lines(self, path, contents.data, contents.size);
+    if (finder_index_entry_build(&built, relpath, &contents.st, contents.data, contents.size, &self->scratch) != 0 ||
+        !add_entry(self, &built))
+    {
+        perror("finder: malloc");
+        finder_index_entry_release(&built);
+    }
+    else
+    {
+        self->rebuilt++;
+    }
+    release_contents(&contents);
+}
+
+static void process_file(struct worker *self, const char *path)
+{
+    struct file_contents contents;
+
+    if (self->finder->indexing)
+    {
+        process_file_indexed(self, path);
+    }
+    else if (open_contents(path, &contents) == 0)
+    {
+        self->files++;
+        add_matching_lines(self, path, contents.data, contents.size);
+        release_contents(&contents);
+    }
+}
+
+static char *join_path(const char *dir, const char *name)
+{
+    size_t dir_len = strlen(dir);
+    size_t name_len = strlen(name);
+    bool slash = dir_len > 0 && dir[dir_len - 1] != '/';
+    char *path = malloc(dir_len + slash + name_len + 1);
+
+    if (path != NULL)
+    {
+        memcpy(path, dir, dir_len);
+        path[dir_len] = '/';
+        memcpy(path + dir_len + slash, name, name_len + 1);
+    }
+    return path;
+}
+
+static void process_dir(struct worker *self, const char *path, struct dir_node *parent)
+{
+    struct dir_node *node;
+    struct dir_node *ancestor;
+    struct dirent *entry;
+    struct stat st;
+    DIR *dir = opendir(path);
+
+    if (dir == NULL)
+    {
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+        return;
+    }
+    if (fstat(dirfd(dir), &st) == -1)
+    {
+        closedir(dir);
+        return;
+    }
+    for (ancestor = parent; ancestor != NULL; ancestor = ancestor->parent)
+    {
+        if (ancestor->dev == st.st_dev && ancestor->ino == st.st_ino)
+        {
+            fprintf(stderr, "finder: %s: warning: recursive directory loop\n", path);
+            closedir(dir);
+            return;
+        }
+    }
+    node = malloc(sizeof(*node));
+    if (node == NULL)
+    {
+        closedir(dir);
+        return;
+    }
+    node->dev = st.st_dev;
+    node->ino = st.st_ino;
+    node->parent = parent;
+    // the reference held by this function, each queued entry takes another
+    atomic_init(&node->refcount, 1);
+    if (parent != NULL)
+    {
+        atomic_fetch_add(&parent->refcount, 1);
+    }
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        unsigned char type = entry->d_type;
+        char *child;
+
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+        child = join_path(path, entry->d_name);
+        if (child == NULL)
+        {
+            perror("finder: malloc");
+            continue;
+        }
+        // resolve links and filesystems without d_type, grep -R follows every link
+        if (type == DT_LNK || type == DT_UNKNOWN)
+        {
+            type = stat(child, &st) == 0 && S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+        }
+        queue_work(self, child, type == DT_DIR, node);
+    }
+    closedir(dir);
+    dir_node_put(node);
+}
+
+static bool find_work(struct worker *self, struct work_item *item_rtn)
+{
+    struct finder *finder = self->finder;
+    int i;
+
+    if (deque_pop_back(&self->deque, item_rtn))
+    {
+        return true;
+    }
+    for (i = 1; i < finder->nworkers; i++)
+    {
+        if (deque_steal_front(&finder->workers[(self->index + i) % finder->nworkers].deque, item_rtn))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void *worker_threadfunc(void *thread_param)
+{
+    struct worker *self = thread_param;
+    struct finder *finder = self->finder;
+    struct work_item item;
+    struct timespec deadline;
+
+    for (;;)
+    {
+        if (find_work(self, &item))
+        {
+            if (item.is_dir)
+            {
+                process_dir(self, item.path, item.parent);
+            }
+            else
+            {
+                process_file(self, item.path);
+            }
+            dir_node_put(item.parent);
+            free(item.path);
+            if (atomic_fetch_sub(&finder->pending, 1) == 1)
+            {
+                // the last item is done, wake everyone to exit
+                pthread_mutex_lock(&finder->idle_lock);
+                pthread_cond_broadcast(&finder->idle_cond);
+                pthread_mutex_unlock(&finder->idle_lock);
+            }
+            continue;
+        }
+        if (atomic_load(&finder->pending) == 0)
+        {
+            break;
+        }
+        // other threads are still reading directories which may produce more work; a
+        // wake up can be missed between the search above and sleeping, hence the timeout
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += IDLE_WAIT_NS;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_mutex_lock(&finder->idle_lock);
+        atomic_fetch_add(&finder->idle, 1);
+        if (atomic_load(&finder->pending) != 0)
+        {
+            pthread_cond_timedwait(&finder->idle_cond, &finder->idle_lock, &deadline);
+        }
+        atomic_fetch_sub(&finder->idle, 1);
+        pthread_mutex_unlock(&finder->idle_lock);
+    }
+    return NULL;
+}
+
+/**
+ * @return true if @param index_path, which need not exist yet, lies inside @param root,
+ * where it would be counted and indexed itself
+ */
+static bool index_inside_root(const char *index_path, const char *root)
+{
+    char *copy = strdup(index_path);
+    char *dir = copy != NULL ? realpath(dirname(copy), NULL) : NULL;
+    size_t root_len = strlen(root);
+    bool inside = dir == NULL ||
+                  (strncmp(dir, root, root_len) == 0 && (dir[root_len] == '\0' || dir[root_len] == '/' ||
+                                                         strcmp(root, "/") == 0));
+
+    free(dir);
+    free(copy);
+    return inside;
+}
+
+/**
+ * Loads the index for @param filesdir and prepares the needle trigrams
+ * @return 0 on success, -1 after printing an error
+ */
+static int index_open(struct finder *finder, const char *index_path, const char *filesdir, char **root_rtn)
+{
+    char *root = realpath(filesdir, NULL);
+
+    if (root == NULL)
+    {
+        fprintf(stderr, "finder: %s: %s\n", filesdir, strerror(errno));
+        return -1;
+    }
+    if (index_inside_root(index_path, root))
+    {
+        fprintf(stderr, "finder: the index %s must be in an existing directory outside %s\n", index_path, filesdir);
+        free(root);
+        return -1;
+    }
+    finder->needle_trigrams = malloc((finder->needle_len + 1) * sizeof(*finder->needle_trigrams));
+    if (finder->needle_trigrams == NULL || finder_index_load(&finder->index, index_path, root) != 0)
+    {
+        fprintf(stderr, "finder: %s: %s\n", index_path, strerror(errno));
+        free(root);
+        return -1;
+    }
+    finder->needle_ntrigrams = finder_index_needle_trigrams(finder->needle, finder->needle_len,
+                                                            finder->needle_trigrams);
+    finder->indexing = true;
+    *root_rtn = root;
+    return 0;
+}
+
+/**
+ * Rewrites the index from the entries the workers collected, if any file was added,
+ * changed or removed since it was loaded, and releases the entries
+ */
+static void index_close(struct finder *finder, const char *index_path, const char *root)
+{
+    struct finder_index_entry *entries;
+    size_t count = 0;
+    size_t rebuilt = 0;
+    size_t n = 0;
+    int i;
+
+    for (i = 0; i < finder->nworkers; i++)
+    {
+        count += finder->workers[i].nentries;
+        rebuilt += finder->workers[i].rebuilt;
+    }
+    entries = malloc((count > 0 ? count : 1) * sizeof(*entries));
+    for (i = 0; i < finder->nworkers && entries != NULL; i++)
+    {
+        memcpy(entries + n, finder->workers[i].entries, finder->workers[i].nentries * sizeof(*entries));
+        n += finder->workers[i].nentries;
+    }
+    // unchanged entries point into the old mapping, which stays valid past the rename
+    if (entries == NULL || ((rebuilt > 0 || count != finder->index.count) &&
+                            finder_index_save(index_path, root, entries, count) != 0))
+    {
+        fprintf(stderr, "finder: %s could not be written: %s\n", index_path, strerror(errno));
+    }
+    for (i = 0; i < finder->nworkers; i++)
+    {
+        struct worker *worker = &finder->workers[i];
+        size_t j;
+
+        for (j = 0; j < worker->nentries; j++)
+        {
+            finder_index_entry_release(&worker->entries[j]);
+        }
+        free(worker->entries);
+        finder_index_scratch_release(&worker->scratch);
+    }
+    free(entries);
+    free(finder->needle_trigrams);
+    finder_index_release(&finder->index);
+}
+
+int main(int argc, char **argv)
+{
+    struct finder finder = {
+        .idle_lock = PTHREAD_MUTEX_INITIALIZER,
+        .idle_cond = PTHREAD_COND_INITIALIZER,
+    };
+    struct stat st;
+    unsigned long files = 0;
+    unsigned long lines = 0;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *index_path = NULL;
+    const char *filesdir;
+    char *index_root = NULL;
+    char *root;
+    int started;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "+i:")) != -1)
+    {
+        if (opt != 'i')
+        {
+            fprintf(stderr, "Usage: %s [-i index] <filesdir> <searchstr>\n", argv[0]);
+            return 1;
+        }
+        index_path = optarg;
+    }
+    if (argc - optind != 2)
+    {
+        printf("Missing a paramater\n");
+        return 1;
+    }
+    filesdir = argv[optind];
+    if (stat(filesdir, &st) == -1 || !S_ISDIR(st.st_mode))
+    {
+        printf("filesdir must be a file directory\n");
+        return 1;
+    }
+    finder.needle = argv[optind + 1];
+    finder.needle_len = strlen(finder.needle);
+    finder.root_len = strlen(filesdir);
+    finder.nworkers = cpus < 1 ? 1 : cpus > MAX_FINDER_THREADS ? MAX_FINDER_THREADS : cpus;
+    finder.workers = calloc(finder.nworkers, sizeof(*finder.workers));
+    root = strdup(filesdir);
+    if (finder.workers == NULL || root == NULL)
+    {
+        perror("finder: malloc");
+        return 1;
+    }
+    if (index_path != NULL && index_open(&finder, index_path, filesdir, &index_root) != 0)
+    {
+        return 1;
+    }
+    for (i = 0; i < finder.nworkers; i++)
+    {
+        finder.workers[i].finder = &finder;
+        finder.workers[i].index = i;
+        pthread_mutex_init(&finder.workers[i].deque.lock, NULL);
+    }
+    queue_work(&finder.workers[0], root, true, NULL);
+
+    // worker 0 runs on this thread, so a failed pthread_create only costs parallelism
+    for (started = 1; started < finder.nworkers; started++)
+    {
+        if (pthread_create(&finder.workers[started].thread, NULL, worker_threadfunc,
+                           &finder.workers[started]) != 0)
+        {
+            break;
+        }
+    }
+    worker_threadfunc(&finder.workers[0]);
+    for (i = 1; i < started; i++)
+    {
+        pthread_join(finder.workers[i].thread, NULL);
+    }
+    if (finder.indexing)
+    {
+        index_close(&finder, index_path, index_root);
+        free(index_root);
+    }
+    for (i = 0; i < finder.nworkers; i++)
+    {
+        files += finder.workers[i].files;
+        lines += finder.workers[i].lines;
+        free(finder.workers[i].deque.items);
+        pthread_mutex_destroy(&finder.workers[i].deque.lock);
+    }
+    free(finder.workers);
+
+    printf("The number of files are %lu and the number of matching lines are %lu\n", files, lines);
+    return 0;
+}
@@ -19,6 +19,21 @@ if [ ! -d $1 ]; then
     exit 1
 fi
 
+# the native finder, when built, gives the same message reading each file only once.
+# It matches searchstr literally while grep reads it as a basic regular expression, so
+# it is only used when searchstr has no special characters, and only when it runs here:
+# manual-linux.sh leaves a finder cross compiled for the target in this directory.
+finder_bin=$(dirname "$0")/finder
+case $2 in
+    *[].[*^\$\\]*)
+        ;;
+    *)
+        if [ -x "$finder_bin" ] && "$finder_bin" 2>/dev/null | grep -q "^Missing a paramater"; then
+            exec "$finder_bin" "$1" "$2"
+        fi
+        ;;
+esac
+
 filesdir=$1
 searchstr=$2
 echo "The number of files are $(grep $searchstr -R $filesdir -c | awk -F: '{ print $1 }' | uniq | wc -l) and the number of matching lines are $(grep $searchstr -R $filesdir | wc -l)"
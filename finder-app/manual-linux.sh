@@ -132,6 +132,7 @@ make CROSS_COMPILE=${CROSS_COMPILE}
 echo "Copy scripts and executables to target rootfs"
 mkdir -p $ROOT_FS/home/conf $ROOT_FS/conf
 cp writer $ROOT_FS/home
+cp finder $ROOT_FS/home
 cp finder.sh $ROOT_FS/home
 cp finder-test.sh $ROOT_FS/home
 cp autorun-qemu.sh $ROOT_FS/home
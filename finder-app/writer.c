@@ -1,41 +1,144 @@
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <syslog.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-// a program's arguments includes the program's name and the passed in arguments
-// char is 1 byte and represents a character
-// char* represents a string, which is an array of characters
-// char** represents an array of strings
-int main(int argc, char **argv)
+// alignment and size granularity of O_DIRECT buffers, a multiple of any logical block size
+#define DIRECT_IO_ALIGN 4096
+#define MAX_WRITER_THREADS 64
+
+// one line of a batch manifest: "<path>\t<content>"
+struct manifest_entry
 {
-    if (argc != 3)
-        return 1;
+    char *path;
+    char *content;
+    size_t len;
+};
 
-    // opens a connection to the system logger
-    openlog("writer_c", LOG_PID, LOG_USER);
+struct batch_options
+{
+    int threads;
+    bool preallocate;
+    bool direct;
+};
 
-    // grab the arguments
-    char *writefile = argv[1];
-    char *writestr = argv[2];
+struct batch_state
+{
+    const struct manifest_entry *entries;
+    size_t count;
+    const struct batch_options *options;
+    // index of the next entry a worker picks up
+    atomic_size_t next;
+    atomic_size_t failed;
+    atomic_size_t bytes;
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s <writefile> <writestr>\n"
+                    "       %s -b <manifest|-> [-j threads] [-f] [-d]\n"
+                    "  -b  write every \"<path>\\t<content>\" line of manifest, - for stdin;\n"
+                    "      \\n, \\t and \\\\ in content are unescaped\n"
+                    "  -j  writer threads, default the number of CPUs\n"
+                    "  -f  fallocate each file to its final size before writing\n"
+                    "  -d  write with O_DIRECT where the filesystem supports it\n",
+            prog, prog);
+}
+
+// creates dirpath and any missing parents, like mkdir -p
+static int mkdir_p(const char *dirpath)
+{
+    char *path = strdup(dirpath);
+    char *p;
+    int rc = 0;
+
+    if (path == NULL)
+    {
+        return -1;
+    }
+    for (p = path + 1; rc == 0; p++)
+    {
+        if (*p != '/' && *p != '\0')
+        {
+            continue;
+        }
+        char c = *p;
+        *p = '\0';
+        if (mkdir(path, 0777) == -1 && errno != EEXIST)
+        {
+            rc = -1;
+        }
+        *p = c;
+        if (c == '\0')
+        {
+            break;
+        }
+    }
+    free(path);
+    return rc;
+}
 
-    //  allocates bytes equal to the length of writefile plus one for the null terminating character, each the size of a char.
-    char *writefile_cpy = (char *)malloc(strlen(writefile + 1) * sizeof(char));
-    strcpy(writefile_cpy, writefile);
+// creates the directory which will hold writefile
+static int create_parent_dir(const char *writefile)
+{
+    // dirname may modify its argument, so work on a copy
+    char *writefile_cpy = strdup(writefile);
+    struct stat st = {0};
+    int rc = 0;
 
+    if (writefile_cpy == NULL)
+    {
+        return -1;
+    }
     // grab the directory path from the writefile path
     char *dirpath = dirname(writefile_cpy);
 
-    // The stat structure is typically used to hold file information
-    struct stat st = {0};
     // the stat function returns information about a file, it takes a path to the file and a pointer to a stat structure
     if (stat(dirpath, &st) == -1)
-        mkdir(dirpath, 0777);
+    {
+        rc = mkdir_p(dirpath);
+    }
+    free(writefile_cpy);
+    return rc;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int write_single(const char *writefile, const char *writestr)
+{
+    if (create_parent_dir(writefile) != 0)
+    {
+        syslog(LOG_ERR, "directory for %s could not be created: %s", writefile, strerror(errno));
+        return 1;
+    }
 
     int pfd = open(writefile, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
     if (pfd == -1)
@@ -44,11 +147,388 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    write(pfd, writestr, strlen(writestr));
     syslog(LOG_DEBUG, "Writing \"%s\" to \"%s\"", writestr, writefile);
+    if (write_all(pfd, writestr, strlen(writestr)) != 0)
+    {
+        syslog(LOG_ERR, "write to %s failed: %s", writefile, strerror(errno));
+        close(pfd);
+        return 1;
+    }
     close(pfd);
+    return 0;
+}
+
+// decodes \n, \t and \\ in place and returns the decoded length
+static size_t unescape(char *s)
+{
+    char *out = s;
+    char *in;
+
+    for (in = s; *in != '\0'; in++)
+    {
+        if (*in == '\\' && in[1] != '\0')
+        {
+            in++;
+            *out++ = *in == 'n' ? '\n' : *in == 't' ? '\t' : *in;
+        }
+        else
+        {
+            *out++ = *in;
+        }
+    }
+    *out = '\0';
+    return out - s;
+}
+
+/**
+ * Reads every line of the manifest into @param entries_rtn
+ * @return the number of entries, or -1 with errno set
+ */
+static ssize_t read_manifest(const char *manifest, struct manifest_entry **entries_rtn)
+{
+    FILE *fp = strcmp(manifest, "-") == 0 ? stdin : fopen(manifest, "r");
+    struct manifest_entry *entries = NULL;
+    size_t count = 0;
+    size_t cap = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t len;
+    size_t lineno = 0;
+
+    if (fp == NULL)
+    {
+        return -1;
+    }
+    while ((len = getline(&line, &line_size, fp)) != -1)
+    {
+        lineno++;
+        if (len > 0 && line[len - 1] == '\n')
+        {
+            line[--len] = '\0';
+        }
+        if (len == 0)
+        {
+            continue;
+        }
+        char *tab = strchr(line, '\t');
+        if (tab == NULL)
+        {
+            fprintf(stderr, "%s:%zu: expected <path>\\t<content>\n", manifest, lineno);
+            errno = EINVAL;
+            goto fail;
+        }
+        if (count == cap)
+        {
+            size_t new_cap = cap == 0 ? 256 : cap * 2;
+            struct manifest_entry *grown = realloc(entries, new_cap * sizeof(*entries));
+            if (grown == NULL)
+            {
+                goto fail;
+            }
+            entries = grown;
+            cap = new_cap;
+        }
+        *tab = '\0';
+        // the path and content share one allocation, the line itself
+        entries[count].path = line;
+        entries[count].content = tab + 1;
+        entries[count].len = unescape(tab + 1);
+        count++;
+        line = NULL;
+        line_size = 0;
+    }
+    free(line);
+    if (fp != stdin)
+    {
+        fclose(fp);
+    }
+    *entries_rtn = entries;
+    return count;
+
+fail:
+    free(line);
+    while (count > 0)
+    {
+        free(entries[--count].path);
+    }
+    free(entries);
+    if (fp != stdin)
+    {
+        fclose(fp);
+    }
+    return -1;
+}
+
+static int compare_strings(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// creates every directory the manifest needs once, instead of checking it per file
+static int create_manifest_dirs(const struct manifest_entry *entries, size_t count)
+{
+    char **dirs = malloc(count * sizeof(*dirs));
+    size_t ndirs = 0;
+    size_t i;
+    int rc = 0;
+
+    if (dirs == NULL)
+    {
+        return count == 0 ? 0 : -1;
+    }
+    for (i = 0; i < count; i++)
+    {
+        char *path_cpy = strdup(entries[i].path);
+        if (path_cpy == NULL)
+        {
+            rc = -1;
+            break;
+        }
+        // dirname may return a pointer into its argument or a static string
+        dirs[ndirs] = strdup(dirname(path_cpy));
+        free(path_cpy);
+        if (dirs[ndirs] == NULL)
+        {
+            rc = -1;
+            break;
+        }
+        ndirs++;
+    }
+    qsort(dirs, ndirs, sizeof(*dirs), compare_strings);
+    for (i = 0; i < ndirs; i++)
+    {
+        if (rc == 0 && (i == 0 || strcmp(dirs[i], dirs[i - 1]) != 0) && mkdir_p(dirs[i]) != 0)
+        {
+            syslog(LOG_ERR, "directory %s could not be created: %s", dirs[i], strerror(errno));
+            rc = -1;
+        }
+    }
+    for (i = 0; i < ndirs; i++)
+    {
+        free(dirs[i]);
+    }
+    free(dirs);
+    return rc;
+}
+
+/**
+ * Writes content through O_DIRECT, which needs an aligned buffer and length, so it is
+ * copied into @param bounce padded to a block multiple and the file is truncated back
+ * @return 0 on success, -1 with errno set
+ */
+static int write_direct(int fd, const struct manifest_entry *entry, char **bounce, size_t *bounce_size)
+{
+    size_t padded = (entry->len + DIRECT_IO_ALIGN - 1) & ~(size_t)(DIRECT_IO_ALIGN - 1);
+
+    if (padded == 0)
+    {
+        return 0;
+    }
+    if (padded > *bounce_size)
+    {
+        free(*bounce);
+        *bounce = NULL;
+        *bounce_size = 0;
+        if (posix_memalign((void **)bounce, DIRECT_IO_ALIGN, padded) != 0)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        *bounce_size = padded;
+    }
+    memcpy(*bounce, entry->content, entry->len);
+    memset(*bounce + entry->len, 0, padded - entry->len);
+    if (write_all(fd, *bounce, padded) != 0)
+    {
+        return -1;
+    }
+    return padded == entry->len ? 0 : ftruncate(fd, entry->len);
+}
+
+static int write_entry(const struct manifest_entry *entry, const struct batch_options *options,
+                       char **bounce, size_t *bounce_size)
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    bool direct = options->direct;
+    int fd = -1;
+    int rc;
+
+    if (direct)
+    {
+        fd = open(entry->path, flags | O_DIRECT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        // filesystems such as tmpfs refuse O_DIRECT, write those through the page cache
+        direct = fd != -1;
+    }
+    if (fd == -1)
+    {
+        fd = open(entry->path, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    }
+    if (fd == -1)
+    {
+        return -1;
+    }
+    // preallocating is only a hint, so filesystems without fallocate are not an error
+    if (options->preallocate && entry->len > 0)
+    {
+        posix_fallocate(fd, 0, entry->len);
+    }
+    rc = direct ? write_direct(fd, entry, bounce, bounce_size) : write_all(fd, entry->content, entry->len);
+    if (close(fd) != 0)
+    {
+        rc = -1;
+    }
+    return rc;
+}
+
+static void *batch_threadfunc(void *thread_param)
+{
+    struct batch_state *state = thread_param;
+    char *bounce = NULL;
+    size_t bounce_size = 0;
+    size_t i;
+
+    while ((i = atomic_fetch_add_explicit(&state->next, 1, memory_order_relaxed)) < state->count)
+    {
+        const struct manifest_entry *entry = &state->entries[i];
+        if (write_entry(entry, state->options, &bounce, &bounce_size) != 0)
+        {
+            syslog(LOG_ERR, "file %s could not be written: %s", entry->path, strerror(errno));
+            atomic_fetch_add_explicit(&state->failed, 1, memory_order_relaxed);
+        }
+        else
+        {
+            atomic_fetch_add_explicit(&state->bytes, entry->len, memory_order_relaxed);
+        }
+    }
+    free(bounce);
+    return NULL;
+}
+
+static int write_batch(const char *manifest, const struct batch_options *options)
+{
+    struct manifest_entry *entries = NULL;
+    struct batch_state state = { .options = options };
+    pthread_t thread[MAX_WRITER_THREADS];
+    struct timespec start;
+    struct timespec end;
+    double elapsed;
+    ssize_t count;
+    int started = 0;
+    size_t j;
+    int i;
 
+    count = read_manifest(manifest, &entries);
+    if (count == -1)
+    {
+        fprintf(stderr, "%s: %s\n", manifest, strerror(errno));
+        return 1;
+    }
+    state.entries = entries;
+    state.count = count;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (create_manifest_dirs(entries, count) != 0)
+    {
+        state.failed = count;
+    }
+    else
+    {
+        for (i = 0; i < options->threads && i < count; i++)
+        {
+            if (pthread_create(&thread[started], NULL, batch_threadfunc, &state) == 0)
+            {
+                started++;
+            }
+        }
+        // with no thread at all, write on this one
+        if (started == 0)
+        {
+            batch_threadfunc(&state);
+        }
+        for (i = 0; i < started; i++)
+        {
+            pthread_join(thread[i], NULL);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    size_t written = count - state.failed;
+    printf("wrote %zu of %zd files, %zu bytes in %.3f s: %.0f files/s, %.0f bytes/s\n",
+           written, count, (size_t)state.bytes, elapsed,
+           elapsed > 0 ? written / elapsed : 0, elapsed > 0 ? state.bytes / elapsed : 0);
+    syslog(LOG_DEBUG, "batch %s: wrote %zu of %zd files, %zu bytes", manifest, written, count,
+           (size_t)state.bytes);
+
+    for (j = 0; j < state.count; j++)
+    {
+        free(entries[j].path);
+    }
+    free(entries);
+    return state.failed == 0 ? 0 : 1;
+}
+
+// a program's arguments includes the program's name and the passed in arguments
+// char is 1 byte and represents a character
+// char* represents a string, which is an array of characters
+// char** represents an array of strings
+int main(int argc, char **argv)
+{
+    struct batch_options options = { 0 };
+    const char *manifest = NULL;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    int rc;
+
+    // only the batch mode takes options, a plain writefile may not start with a dash
+    if (argc < 2 || argv[1][0] != '-')
+    {
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        // opens a connection to the system logger
+        openlog("writer_c", LOG_PID, LOG_USER);
+        rc = write_single(argv[1], argv[2]);
+        closelog();
+        return rc;
+    }
+
+    options.threads = cpus > 0 ? cpus : 1;
+    while ((opt = getopt(argc, argv, "b:j:fd")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            manifest = optarg;
+            break;
+        case 'j':
+            options.threads = atoi(optarg);
+            break;
+        case 'f':
+            options.preallocate = true;
+            break;
+        case 'd':
+            options.direct = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (manifest == NULL || optind != argc || options.threads < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (options.threads > MAX_WRITER_THREADS)
+    {
+        options.threads = MAX_WRITER_THREADS;
+    }
+
+    openlog("writer_c", LOG_PID, LOG_USER);
+    rc = write_batch(manifest, &options);
     closelog();
-    free(writefile_cpy);
-    return 0;
-}
\ No newline at end of file
+    return rc;
+}
@@ -0,0 +1,450 @@
+/**
+ * @file aesd-packet-store.c
+ * @brief The aesdsocket data file with retention and background compaction
+ *
+ * The store lock covers the index, the current descriptor and the file sizes, and is held
+ * for appends, snapshots and the final step of a compaction only.  The current file never
+ * shrinks while it is current: dropped packets stay in it until the compactor has copied
+ * everything after them to tmp_path and renamed it over path, after which file_base
+ * advances to the first byte that was copied.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include "aesd-packet-store.h"
+#include "aesd-probes.h"
+
+#define COPY_CHUNK (1 << 20)
+
+static void store_lock(struct aesd_packet_store *store)
+{
+    AESD_PROBE1(lock_wait, &store->lock);
+    pthread_mutex_lock(&store->lock);
+    AESD_PROBE1(lock_acquired, &store->lock);
+}
+
+static void store_unlock(struct aesd_packet_store *store)
+{
+    pthread_mutex_unlock(&store->lock);
+    AESD_PROBE1(lock_released, &store->lock);
+}
+
+static time_t monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t rc = write(fd, buf, len);
+        if (rc == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        buf += rc;
+        len -= rc;
+    }
+    return 0;
+}
+
+/**
+ * Copies bytes @param from to @param to of @param src_fd to the end of @param dst_fd,
+ * in the kernel when the filesystem allows it
+ * @return 0 on success, a negative errno value on failure
+ */
+static int copy_range(int src_fd, off_t from, off_t to, int dst_fd)
+{
+    char *buf = NULL;
+    int rc = 0;
+
+    while (from < to) {
+        ssize_t copied = -1;
+        size_t want = to - from > COPY_CHUNK ? COPY_CHUNK : to - from;
+
+        if (buf == NULL) {
+            copied = copy_file_range(src_fd, &from, dst_fd, NULL, want, 0);
+            if (copied == -1 && errno != EINTR) {
+                /* Older kernels and some filesystems refuse, fall back to copying by hand */
+                buf = malloc(COPY_CHUNK);
+                if (buf == NULL) {
+                    rc = -ENOMEM;
+                    break;
+                }
+            }
+            else if (copied == 0) {
+                rc = -EIO;
+                break;
+            }
+        }
+        if (buf != NULL) {
+            copied = pread(src_fd, buf, want, from);
+            if (copied > 0) {
+                rc = write_all(dst_fd, buf, copied);
+                if (rc != 0) {
+                    break;
+                }
+                from += copied;
+            }
+            else if (copied == 0) {
+                rc = -EIO;
+                break;
+            }
+            else if (errno != EINTR) {
+                rc = -errno;
+                break;
+            }
+        }
+    }
+    free(buf);
+    return rc;
+}
+
+/**
+ * Drops the oldest packets until the store is within its limits at time @param now.
+ * Called with the store lock held.
+ */
+static void enforce_limits(struct aesd_packet_store *store, time_t now)
+{
+    struct aesd_packet_index *index = store->index;
+    struct aesd_packet_record *oldest;
+
+    while ((oldest = aesd_packet_index_at(index, 0)) != NULL) {
+        uint32_t count = aesd_packet_index_count(index);
+        if (store->limits.max_packets != 0 && count > store->limits.max_packets) {
+            aesd_packet_index_pop(index, NULL);
+        }
+        else if (store->limits.max_bytes != 0 && count > 1 &&
+                 aesd_packet_index_total_size(index) > store->limits.max_bytes) {
+            aesd_packet_index_pop(index, NULL);
+        }
+        else if (store->limits.max_age_s != 0 && now - oldest->time >= (time_t)store->limits.max_age_s) {
+            aesd_packet_index_pop(index, NULL);
+        }
+        else {
+            break;
+        }
+    }
+}
+
+/**
+ * @return true once dropped packets make up at least half of the current file
+ * Called with the store lock held.
+ */
+static bool compaction_due(const struct aesd_packet_store *store)
+{
+    size_t dropped = store->index->base_offs - store->file_base;
+    return dropped >= AESD_PACKET_STORE_COMPACT_MIN && dropped >= store->file_size - dropped;
+}
+
+/**
+ * Indexes the @param size bytes already in the file, one packet per line,
+ * as if they had just arrived
+ * @return 0 on success, a negative errno value on failure
+ */
+static int index_existing(struct aesd_packet_store *store, size_t size)
+{
+    struct aesd_packet_record record = { .size = 0, .time = monotonic_seconds() };
+    char *buf = malloc(COPY_CHUNK);
+    off_t pos = 0;
+
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
+    while ((size_t)pos < size) {
+        ssize_t rc = pread(store->fd, buf, COPY_CHUNK, pos);
+        if (rc <= 0) {
+            if (rc == -1 && errno == EINTR) {
+                continue;
+            }
+            free(buf);
+            return rc == 0 ? -EIO : -errno;
+        }
+        for (ssize_t i = 0; i < rc; i++) {
+            record.size++;
+            if (buf[i] == '\n') {
+                aesd_packet_index_add(store->index, &record, NULL);
+                record.size = 0;
+            }
+        }
+        pos += rc;
+    }
+    if (record.size != 0) {
+        aesd_packet_index_add(store->index, &record, NULL);
+    }
+    free(buf);
+    enforce_limits(store, record.time);
+    return 0;
+}
+
+/**
+ * Rewrites the retained packets to a new file if enough of the current one is dropped
+ * data.  The bulk of the copy runs unlocked; packets appended meanwhile are copied after
+ * it with the lock held, just before the rename.
+ * @return 0 when compacted or not due, a negative errno value on failure
+ */
+static int compact(struct aesd_packet_store *store)
+{
+    off_t from;
+    off_t to;
+    size_t new_base;
+    int src_fd;
+    int tmp_fd;
+    int rc;
+
+    store_lock(store);
+    if (!compaction_due(store)) {
+        store_unlock(store);
+        return 0;
+    }
+    new_base = store->index->base_offs;
+    from = new_base - store->file_base;
+    to = store->file_size;
+    src_fd = dup(store->fd);
+    store_unlock(store);
+    if (src_fd == -1) {
+        rc = -errno;
+        syslog(LOG_ERR, "Failed to duplicate %s for compaction: %m", store->path);
+        return rc;
+    }
+
+    tmp_fd = open(store->tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (tmp_fd == -1) {
+        rc = -errno;
+        syslog(LOG_ERR, "Failed to create %s: %m", store->tmp_path);
+        close(src_fd);
+        return rc;
+    }
+    rc = copy_range(src_fd, from, to, tmp_fd);
+
+    store_lock(store);
+    if (rc == 0) {
+        rc = copy_range(src_fd, to, store->file_size, tmp_fd);
+    }
+    if (rc == 0 && fcntl(tmp_fd, F_SETFL, O_APPEND) == -1) {
+        rc = -errno;
+    }
+    if (rc == 0 && rename(store->tmp_path, store->path) == -1) {
+        rc = -errno;
+    }
+    if (rc == 0) {
+        close(store->fd);
+        store->fd = tmp_fd;
+        store->file_size -= new_base - store->file_base;
+        store->file_base = new_base;
+    }
+    store_unlock(store);
+
+    if (rc != 0) {
+        syslog(LOG_ERR, "Failed to compact %s: %s", store->path, strerror(-rc));
+        unlink(store->tmp_path);
+        close(tmp_fd);
+    }
+    close(src_fd);
+    return rc;
+}
+
+/**
+ * Sleeps until signalled, or for up to a second when packets expire and then drops the
+ * expired ones.  Called with the store lock held.
+ */
+static void wait_for_work(struct aesd_packet_store *store)
+{
+    if (store->limits.max_age_s != 0) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec++;
+        pthread_cond_timedwait(&store->cond, &store->lock, &deadline);
+        enforce_limits(store, monotonic_seconds());
+    }
+    else {
+        pthread_cond_wait(&store->cond, &store->lock);
+    }
+}
+
+/**
+ * Drops packets as they age out and compacts when appends or expiry left enough dropped
+ * data.  Appends signal whether or not this thread is waiting, so a compaction which
+ * became due before it waited or while it compacted is started without waiting, unless
+ * the last attempt failed.
+ */
+static void *compactor_thread(void *arg)
+{
+    struct aesd_packet_store *store = arg;
+    bool failed = false;
+
+    pthread_mutex_lock(&store->lock);
+    while (!store->stopping) {
+        if (failed || !compaction_due(store)) {
+            wait_for_work(store);
+        }
+        if (!store->stopping && compaction_due(store)) {
+            pthread_mutex_unlock(&store->lock);
+            failed = compact(store) != 0;
+            pthread_mutex_lock(&store->lock);
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
+    return NULL;
+}
+
+/**
+ * Opens the store at @param path, indexing any packets already in the file one per line.
+ * @param limits the retention policy; when NULL or all 0 nothing is ever dropped and no
+ *      compactor thread is started.
+ * @return 0 on success, a negative errno value on failure
+ */
+int aesd_packet_store_open(struct aesd_packet_store *store, const char *path,
+                           const struct aesd_packet_store_limits *limits)
+{
+    pthread_condattr_t attr;
+    struct stat st;
+    int rc;
+
+    memset(store, 0, sizeof(*store));
+    store->fd = -1;
+    if (limits != NULL) {
+        store->limits = *limits;
+    }
+    store->limited = store->limits.max_packets != 0 || store->limits.max_bytes != 0 ||
+                     store->limits.max_age_s != 0;
+    if (store->limits.max_packets > AESD_PACKET_INDEX_CAPACITY) {
+        syslog(LOG_WARNING, "Retaining at most %u packets", AESD_PACKET_INDEX_CAPACITY);
+    }
+
+    store->path = strdup(path);
+    if (store->path == NULL || asprintf(&store->tmp_path, "%s.compact", path) == -1) {
+        store->tmp_path = NULL;
+        rc = -ENOMEM;
+        goto fail;
+    }
+    store->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (store->fd == -1 || fstat(store->fd, &st) == -1) {
+        rc = -errno;
+        goto fail;
+    }
+    store->file_size = st.st_size;
+    pthread_mutex_init(&store->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&store->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (!store->limited) {
+        return 0;
+    }
+
+    store->index = malloc(sizeof(*store->index));
+    if (store->index == NULL) {
+        rc = -ENOMEM;
+        goto fail_sync;
+    }
+    aesd_packet_index_init(store->index);
+    rc = index_existing(store, store->file_size);
+    if (rc != 0) {
+        goto fail_sync;
+    }
+    rc = -pthread_create(&store->compactor, NULL, compactor_thread, store);
+    if (rc != 0) {
+        goto fail_sync;
+    }
+    store->compactor_running = true;
+    return 0;
+
+fail_sync:
+    pthread_cond_destroy(&store->cond);
+    pthread_mutex_destroy(&store->lock);
+fail:
+    if (store->fd != -1) {
+        close(store->fd);
+    }
+    free(store->index);
+    free(store->tmp_path);
+    free(store->path);
+    return rc;
+}
+
+/**
+ * Stops the compactor and closes @param store, removing its file when @param remove_file
+ */
+void aesd_packet_store_close(struct aesd_packet_store *store, bool remove_file)
+{
+    if (store->compactor_running) {
+        pthread_mutex_lock(&store->lock);
+        store->stopping = true;
+        pthread_cond_signal(&store->cond);
+        pthread_mutex_unlock(&store->lock);
+        pthread_join(store->compactor, NULL);
+    }
+    close(store->fd);
+    unlink(store->tmp_path);
+    if (remove_file) {
+        unlink(store->path);
+    }
+    pthread_cond_destroy(&store->cond);
+    pthread_mutex_destroy(&store->lock);
+    free(store->index);
+    free(store->tmp_path);
+    free(store->path);
+}
+
+/**
+ * Appends the @param len byte packet in @param buf to @param store and drops whatever the
+ * retention policy no longer keeps
+ * @return 0 on success, a negative errno value on failure
+ */
+int aesd_packet_store_append(struct aesd_packet_store *store, const void *buf, size_t len)
+{
+    int rc;
+
+    store_lock(store);
+    rc = write_all(store->fd, buf, len);
+    if (rc == 0) {
+        store->file_size += len;
+        if (store->limited) {
+            struct aesd_packet_record record = { .size = len, .time = monotonic_seconds() };
+            aesd_packet_index_add(store->index, &record, NULL);
+            enforce_limits(store, record.time);
+            if (compaction_due(store)) {
+                pthread_cond_signal(&store->cond);
+            }
+        }
+    }
+    store_unlock(store);
+    return rc;
+}
+
+/**
+ * Returns the retained packets as bytes @param start_rtn to @param end_rtn of the new
+ * descriptor @param fd_rtn, which the caller reads without holding up the store and closes.
+ * The range stays valid whatever the store does meanwhile.
+ * @return 0 on success, a negative errno value on failure
+ */
+int aesd_packet_store_snapshot(struct aesd_packet_store *store, int *fd_rtn, off_t *start_rtn,
+                               off_t *end_rtn)
+{
+    int rc = 0;
+
+    store_lock(store);
+    *fd_rtn = dup(store->fd);
+    if (*fd_rtn == -1) {
+        rc = -errno;
+    }
+    else {
+        *start_rtn = store->limited ? (off_t)(store->index->base_offs - store->file_base) : 0;
+        *end_rtn = store->file_size;
+    }
+    store_unlock(store);
+    return rc;
+}
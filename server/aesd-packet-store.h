@@ -0,0 +1,100 @@
+/*
+ * aesd-packet-store.h
+ *
+ * The aesdsocket data file in user space mode, with an optional retention policy: keep
+ * the last N packets, the newest packets up to N bytes, and/or packets younger than T
+ * seconds, like the kernel driver keeps its last AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
+ * writes.
+ *
+ * Packets are appended to one file and indexed in an aesd-ring of their sizes and
+ * arrival times.  Packets dropped by the policy only move the start of the retained
+ * range; a compactor thread later copies the retained range to a new file and renames
+ * it over the old one once at least half of the file is dropped data.  The copy is made
+ * without holding the store lock, so appends only wait for the final rename, and a
+ * replay reads its own descriptor of the file it started with, which a rename does not
+ * disturb.
+ *
+ * Without a policy packets are never dropped and the file grows as before.
+ */
+
+#ifndef SERVER_AESD_PACKET_STORE_H
+#define SERVER_AESD_PACKET_STORE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include "../aesd-char-driver/aesd-ring.h"
+
+/* At most 2^AESD_PACKET_INDEX_ORDER packets are retained under any policy */
+#define AESD_PACKET_INDEX_ORDER 16
+#define AESD_PACKET_INDEX_CAPACITY AESD_RING_CAPACITY(AESD_PACKET_INDEX_ORDER)
+/* Dropped data smaller than this is never worth a compaction */
+#define AESD_PACKET_STORE_COMPACT_MIN (64 * 1024)
+
+struct aesd_packet_store_limits
+{
+    /**
+     * Packets to keep, 0 for no limit
+     */
+    uint32_t max_packets;
+    /**
+     * Bytes to keep, 0 for no limit; the newest packet is kept even if larger
+     */
+    size_t max_bytes;
+    /**
+     * Seconds to keep a packet, 0 for no limit
+     */
+    unsigned int max_age_s;
+};
+
+struct aesd_packet_record
+{
+    size_t size;
+    /**
+     * CLOCK_MONOTONIC arrival time in seconds
+     */
+    time_t time;
+};
+
+AESD_RING_DECLARE_SIZED(aesd_packet_index, struct aesd_packet_record, AESD_PACKET_INDEX_ORDER, size)
+
+struct aesd_packet_store
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char *path;
+    char *tmp_path;
+    /**
+     * The current file, opened for appending and reading
+     */
+    int fd;
+    struct aesd_packet_store_limits limits;
+    bool limited;
+    /**
+     * The retained packets, base_offs and total_size in bytes since the store was opened
+     */
+    struct aesd_packet_index *index;
+    /**
+     * Running offset of the first byte of the current file
+     */
+    size_t file_base;
+    size_t file_size;
+    pthread_t compactor;
+    bool compactor_running;
+    bool stopping;
+};
+
+extern int aesd_packet_store_open(struct aesd_packet_store *store, const char *path,
+                                  const struct aesd_packet_store_limits *limits);
+
+extern void aesd_packet_store_close(struct aesd_packet_store *store, bool remove_file);
+
+extern int aesd_packet_store_append(struct aesd_packet_store *store, const void *buf, size_t len);
+
+extern int aesd_packet_store_snapshot(struct aesd_packet_store *store, int *fd_rtn, off_t *start_rtn,
+                                      off_t *end_rtn);
+
+#endif /* SERVER_AESD_PACKET_STORE_H */
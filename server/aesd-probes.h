@@ -0,0 +1,44 @@
+/*
+ * aesd-probes.h
+ *
+ * USDT probes of aesdsocket, for breaking a slow request down into accept, lock wait,
+ * receive, append and replay with perf or bpftrace.  With <sys/sdt.h> (systemtap-sdt-dev)
+ * each probe is a nop plus an ELF note naming it; without, probes compile to nothing.
+ *   bpftrace -l 'usdt:./aesdsocket:*'
+ *   perf buildid-cache --add ./aesdsocket && perf record -e 'sdt_aesdsocket:*' -a
+ *
+ * conn_accept(conn_id, fd)    accept returned connection conn_id, on the main thread
+ * conn_start(conn_id)         the connection thread started; later probes of the
+ *                             connection fire on this thread
+ * packet_framed(conn_id, len) a packet of len bytes was received up to its newline
+ * append_done(conn_id, len)   the packet was appended to the data file or device
+ * replay_done(conn_id, len)   len bytes were replayed to the client
+ * conn_close(conn_id)
+ * lock_wait(lock)             about to take the lock at address lock
+ * lock_acquired(lock)
+ * lock_released(lock)
+ *
+ * Lock probes carry no connection id since the packet store takes its lock on behalf of
+ * every caller; match them to connections by thread, for example
+ *   usdt:./aesdsocket:conn_start { @conn[tid] = arg0; }
+ *   usdt:./aesdsocket:lock_wait { @wait[tid] = nsecs; }
+ *   usdt:./aesdsocket:lock_acquired /@wait[tid]/ { @lock_ns = hist(nsecs - @wait[tid]); }
+ */
+
+#ifndef SERVER_AESD_PROBES_H
+#define SERVER_AESD_PROBES_H
+
+#if defined(__has_include)
+#  if __has_include(<sys/sdt.h>)
+#    include <sys/sdt.h>
+#    define AESD_PROBE1(name, a) DTRACE_PROBE1(aesdsocket, name, a)
+#    define AESD_PROBE2(name, a, b) DTRACE_PROBE2(aesdsocket, name, a, b)
+#  endif
+#endif
+
+#ifndef AESD_PROBE1
+#  define AESD_PROBE1(name, a) do { (void)(a); } while (0)
+#  define AESD_PROBE2(name, a, b) do { (void)(a); (void)(b); } while (0)
+#endif
+
+#endif /* SERVER_AESD_PROBES_H */
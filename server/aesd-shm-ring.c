@@ -0,0 +1,365 @@
+/**
+ * @file aesd-shm-ring.c
+ * @brief Multi producer, single consumer packet ring in shared memory
+ *
+ * Each record is an 8 byte header followed by the packet, padded to a multiple of 8
+ * bytes, so a header never straddles the end of the data area while a packet may wrap
+ * around it.  The first 4 header bytes hold the packet length with AESD_SHM_READY set
+ * once the packet is published.  The consumer zeroes every record it consumes before
+ * moving the tail past it, so a header slot reads as unpublished until a producer
+ * publishes into it, whatever bytes occupied that slot before.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "aesd-shm-ring.h"
+
+#define AESD_SHM_RECORD_HEADER 8
+#define AESD_SHM_READY 0x80000000u
+#define AESD_SHM_RECORD_SIZE(len) (((len) + AESD_SHM_RECORD_HEADER + 7) & ~(uint64_t)7)
+
+static int futex_wait(atomic_uint *uaddr, unsigned int val, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, uaddr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *uaddr, int count)
+{
+    syscall(SYS_futex, uaddr, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+/**
+ * @return the deadline @param timeout_ms from now, for a timeout greater than 0
+ */
+static struct timespec deadline_after(int timeout_ms)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return ts;
+}
+
+/**
+ * Sleeps on @param seq while it still holds @param seen, until @param deadline if
+ * @param timeout_ms is positive, or indefinitely if it is negative.
+ * @return 0 when woken or interrupted, -ETIMEDOUT once the deadline has passed
+ */
+static int wait_seq(atomic_uint *seq, unsigned int seen, int timeout_ms, const struct timespec *deadline)
+{
+    struct timespec now;
+    struct timespec remaining;
+
+    if (timeout_ms < 0) {
+        futex_wait(seq, seen, NULL);
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    remaining.tv_sec = deadline->tv_sec - now.tv_sec;
+    remaining.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+    if (remaining.tv_nsec < 0) {
+        remaining.tv_sec--;
+        remaining.tv_nsec += 1000000000;
+    }
+    if (remaining.tv_sec < 0) {
+        return -ETIMEDOUT;
+    }
+    if (futex_wait(seq, seen, &remaining) == -1 && errno == ETIMEDOUT) {
+        return -ETIMEDOUT;
+    }
+    return 0;
+}
+
+static atomic_uint *record_header(const struct aesd_shm_ring *ring, uint64_t pos)
+{
+    return (atomic_uint *)(ring->data + (pos & (ring->hdr->capacity - 1)));
+}
+
+/**
+ * Copies @param len bytes between @param buf and the data area at running offset
+ * @param pos, splitting the copy where it wraps
+ */
+static void ring_copy(const struct aesd_shm_ring *ring, uint64_t pos, void *buf, size_t len, bool to_ring)
+{
+    size_t at = pos & (ring->hdr->capacity - 1);
+    size_t first = ring->hdr->capacity - at;
+
+    if (first > len) {
+        first = len;
+    }
+    if (to_ring) {
+        memcpy(ring->data + at, buf, first);
+        memcpy(ring->data, (char *)buf + first, len - first);
+    }
+    else {
+        memcpy(buf, ring->data + at, first);
+        memcpy((char *)buf + first, ring->data, len - first);
+    }
+}
+
+static void ring_zero(const struct aesd_shm_ring *ring, uint64_t pos, size_t len)
+{
+    size_t at = pos & (ring->hdr->capacity - 1);
+    size_t first = ring->hdr->capacity - at;
+
+    if (first > len) {
+        first = len;
+    }
+    memset(ring->data + at, 0, first);
+    memset(ring->data, 0, len - first);
+}
+
+/**
+ * Maps the ring in @param fd, which must hold an initialized ring when @param capacity
+ * is 0, or is sized and initialized for @param capacity data bytes otherwise
+ */
+static int ring_map(struct aesd_shm_ring *ring, int fd, size_t capacity)
+{
+    size_t header_size = sizeof(struct aesd_shm_ring_header);
+    struct aesd_shm_ring_header *hdr;
+    struct stat st;
+
+    header_size = (header_size + 63) & ~(size_t)63;
+    if (capacity != 0) {
+        if (ftruncate(fd, header_size + capacity) != 0) {
+            return -errno;
+        }
+        st.st_size = header_size + capacity;
+    }
+    else if (fstat(fd, &st) != 0) {
+        return -errno;
+    }
+    if ((size_t)st.st_size < header_size) {
+        return -EINVAL;
+    }
+    hdr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED) {
+        return -errno;
+    }
+    if (capacity != 0) {
+        memset(hdr, 0, header_size);
+        hdr->capacity = capacity;
+        hdr->version = AESD_SHM_RING_VERSION;
+        // the magic goes last, so openers never see a half initialized header
+        atomic_thread_fence(memory_order_release);
+        hdr->magic = AESD_SHM_RING_MAGIC;
+    }
+    else if (hdr->magic != AESD_SHM_RING_MAGIC || hdr->version != AESD_SHM_RING_VERSION
+            || header_size + hdr->capacity != (size_t)st.st_size) {
+        munmap(hdr, st.st_size);
+        return -EINVAL;
+    }
+    ring->hdr = hdr;
+    ring->data = (char *)hdr + header_size;
+    ring->map_size = st.st_size;
+    ring->fd = fd;
+    return 0;
+}
+
+/**
+ * Creates an empty ring with @param capacity data bytes, a power of two.
+ * @param name the POSIX shared memory object to create, as for shm_open, replacing any
+ *      ring of that name.  When NULL the ring is an anonymous memfd, which other processes
+ *      reach by inheriting ring->fd and calling aesd_shm_ring_open_fd.
+ * @return 0 on success, a negative errno value on failure
+ */
+int aesd_shm_ring_create(struct aesd_shm_ring *ring, const char *name, size_t capacity)
+{
+    int fd;
+    int rc;
+
+    if (capacity < 64 || (capacity & (capacity - 1)) != 0 || capacity > AESD_SHM_READY) {
+        return -EINVAL;
+    }
+    if (name != NULL) {
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    else {
+        fd = memfd_create("aesd-shm-ring", 0);
+    }
+    if (fd == -1) {
+        return -errno;
+    }
+    rc = ring_map(ring, fd, capacity);
+    if (rc != 0) {
+        close(fd);
+        if (name != NULL) {
+            shm_unlink(name);
+        }
+    }
+    return rc;
+}
+
+/**
+ * Attaches to the ring created as @param name by aesd_shm_ring_create
+ * @return 0 on success, a negative errno value on failure
+ */
+int aesd_shm_ring_open(struct aesd_shm_ring *ring, const char *name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+    int rc;
+
+    if (fd == -1) {
+        return -errno;
+    }
+    rc = ring_map(ring, fd, 0);
+    if (rc != 0) {
+        close(fd);
+    }
+    return rc;
+}
+
+/**
+ * Attaches to the ring in @param fd, which is duplicated so the caller keeps its own
+ * @return 0 on success, a negative errno value on failure
+ */
+int aesd_shm_ring_open_fd(struct aesd_shm_ring *ring, int fd)
+{
+    int rc;
+
+    fd = dup(fd);
+    if (fd == -1) {
+        return -errno;
+    }
+    rc = ring_map(ring, fd, 0);
+    if (rc != 0) {
+        close(fd);
+    }
+    return rc;
+}
+
+/**
+ * Unmaps @param ring.  A named ring persists until shm_unlink is called on its name.
+ */
+void aesd_shm_ring_close(struct aesd_shm_ring *ring)
+{
+    munmap(ring->hdr, ring->map_size);
+    close(ring->fd);
+    ring->hdr = NULL;
+    ring->data = NULL;
+}
+
+/**
+ * Appends the @param len byte packet in @param buf to @param ring.  Safe to call from any
+ * number of threads and processes at once.
+ * @param timeout_ms how long to wait for space when the ring is full: 0 not at all,
+ *      negative indefinitely
+ * @return 0 on success, -EAGAIN or -ETIMEDOUT if there was no space in time, -EMSGSIZE
+ *      if the packet could never fit
+ */
+int aesd_shm_ring_push(struct aesd_shm_ring *ring, const void *buf, size_t len, int timeout_ms)
+{
+    struct aesd_shm_ring_header *hdr = ring->hdr;
+    uint64_t record_size = AESD_SHM_RECORD_SIZE((uint64_t)len);
+    struct timespec deadline;
+    uint64_t head;
+    uint64_t tail;
+
+    if (record_size > hdr->capacity) {
+        return -EMSGSIZE;
+    }
+    if (timeout_ms > 0) {
+        deadline = deadline_after(timeout_ms);
+    }
+    head = atomic_load_explicit(&hdr->head, memory_order_relaxed);
+    for (;;) {
+        tail = atomic_load_explicit(&hdr->tail, memory_order_acquire);
+        if (head - tail + record_size <= hdr->capacity) {
+            if (atomic_compare_exchange_weak_explicit(&hdr->head, &head, head + record_size,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+            // head was reloaded by the failed exchange
+            continue;
+        }
+        if (timeout_ms == 0) {
+            return -EAGAIN;
+        }
+        // announce the sleep before the final check, so a pop in between wakes us
+        unsigned int seen = atomic_load(&hdr->space_seq);
+        atomic_fetch_add(&hdr->producers_waiting, 1);
+        tail = atomic_load(&hdr->tail);
+        head = atomic_load_explicit(&hdr->head, memory_order_relaxed);
+        int rc = 0;
+        if (head - tail + record_size > hdr->capacity) {
+            rc = wait_seq(&hdr->space_seq, seen, timeout_ms, &deadline);
+        }
+        atomic_fetch_sub(&hdr->producers_waiting, 1);
+        if (rc != 0) {
+            return rc;
+        }
+        head = atomic_load_explicit(&hdr->head, memory_order_relaxed);
+    }
+    ring_copy(ring, head + AESD_SHM_RECORD_HEADER, (void *)buf, len, true);
+    atomic_store_explicit(record_header(ring, head), (unsigned int)len | AESD_SHM_READY,
+            memory_order_release);
+    atomic_fetch_add(&hdr->data_seq, 1);
+    if (atomic_load(&hdr->consumer_waiting)) {
+        futex_wake(&hdr->data_seq, 1);
+    }
+    return 0;
+}
+
+/**
+ * Removes the oldest packet from @param ring into @param buf.  Only one thread may pop
+ * from a ring at a time.
+ * @param buf_len the size of buf.  A larger packet is left in the ring.
+ * @param timeout_ms how long to wait for a packet when the ring is empty: 0 not at all,
+ *      negative indefinitely
+ * @return the packet length, -EAGAIN or -ETIMEDOUT if no packet arrived in time, or
+ *      -EMSGSIZE if the oldest packet does not fit in buf
+ */
+ssize_t aesd_shm_ring_pop(struct aesd_shm_ring *ring, void *buf, size_t buf_len, int timeout_ms)
+{
+    struct aesd_shm_ring_header *hdr = ring->hdr;
+    uint64_t tail = atomic_load_explicit(&hdr->tail, memory_order_relaxed);
+    atomic_uint *header = record_header(ring, tail);
+    struct timespec deadline;
+    unsigned int value;
+    size_t len;
+
+    if (timeout_ms > 0) {
+        deadline = deadline_after(timeout_ms);
+    }
+    while (!((value = atomic_load_explicit(header, memory_order_acquire)) & AESD_SHM_READY)) {
+        if (timeout_ms == 0) {
+            return -EAGAIN;
+        }
+        unsigned int seen = atomic_load(&hdr->data_seq);
+        atomic_store(&hdr->consumer_waiting, 1);
+        int rc = 0;
+        if (!(atomic_load(header) & AESD_SHM_READY)) {
+            rc = wait_seq(&hdr->data_seq, seen, timeout_ms, &deadline);
+        }
+        atomic_store(&hdr->consumer_waiting, 0);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+    len = value & ~AESD_SHM_READY;
+    if (len > buf_len) {
+        return -EMSGSIZE;
+    }
+    ring_copy(ring, tail + AESD_SHM_RECORD_HEADER, buf, len, false);
+    ring_zero(ring, tail, AESD_SHM_RECORD_SIZE((uint64_t)len));
+    atomic_store_explicit(&hdr->tail, tail + AESD_SHM_RECORD_SIZE((uint64_t)len), memory_order_release);
+    atomic_fetch_add(&hdr->space_seq, 1);
+    if (atomic_load(&hdr->producers_waiting)) {
+        futex_wake(&hdr->space_seq, INT_MAX);
+    }
+    return len;
+}
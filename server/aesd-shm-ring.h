@@ -0,0 +1,84 @@
+/*
+ * aesd-shm-ring.h
+ *
+ * A lock free ring of variable length packets in shared memory, for local producer
+ * processes handing packets to a consumer such as aesdsocket without a socket.
+ *
+ * Any number of producers may push concurrently; a single consumer pops.  Like the
+ * aesd-circular-buffer arena, packets are stored back to back in a power of two byte
+ * area addressed by free running cursors, each preceded by an 8 byte record header.
+ * A producer reserves space by advancing the head cursor with a compare and swap,
+ * copies its packet and then publishes the header, so pushing and popping make no
+ * system calls unless one side has to sleep.  Sleeping uses futexes on counters in the
+ * shared header, and a wake is only issued when the other side announced it sleeps.
+ *
+ * A producer which dies between reserving and publishing stalls the consumer at its
+ * record, so producers should not be killed mid push.
+ */
+
+#ifndef SERVER_AESD_SHM_RING_H
+#define SERVER_AESD_SHM_RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define AESD_SHM_RING_MAGIC 0x47534541 /* "AESG" */
+#define AESD_SHM_RING_VERSION 1
+#define AESD_SHM_RING_DEFAULT_CAPACITY (1 << 20)
+
+/**
+ * The shared state at the start of the mapping, followed by the data area.  Cursors
+ * written by different sides live on separate cache lines.
+ */
+struct aesd_shm_ring_header
+{
+    uint32_t magic;
+    uint32_t version;
+    /**
+     * Size of the data area in bytes, a power of two
+     */
+    uint64_t capacity;
+    /**
+     * Free running byte offset of the end of the last reserved record
+     */
+    _Alignas(64) atomic_uint_fast64_t head;
+    /**
+     * Free running byte offset of the oldest record not yet consumed
+     */
+    _Alignas(64) atomic_uint_fast64_t tail;
+    /**
+     * Bumped after every publish, the futex the consumer sleeps on
+     */
+    _Alignas(64) atomic_uint data_seq;
+    atomic_uint consumer_waiting;
+    /**
+     * Bumped after every pop, the futex producers waiting for space sleep on
+     */
+    _Alignas(64) atomic_uint space_seq;
+    atomic_uint producers_waiting;
+};
+
+struct aesd_shm_ring
+{
+    struct aesd_shm_ring_header *hdr;
+    char *data;
+    size_t map_size;
+    int fd;
+};
+
+extern int aesd_shm_ring_create(struct aesd_shm_ring *ring, const char *name, size_t capacity);
+
+extern int aesd_shm_ring_open(struct aesd_shm_ring *ring, const char *name);
+
+extern int aesd_shm_ring_open_fd(struct aesd_shm_ring *ring, int fd);
+
+extern void aesd_shm_ring_close(struct aesd_shm_ring *ring);
+
+extern int aesd_shm_ring_push(struct aesd_shm_ring *ring, const void *buf, size_t len, int timeout_ms);
+
+extern ssize_t aesd_shm_ring_pop(struct aesd_shm_ring *ring, void *buf, size_t buf_len, int timeout_ms);
+
+#endif /* SERVER_AESD_SHM_RING_H */
@@ -0,0 +1,62 @@
+/**
+ * @file aesdshm-send.c
+ * @brief Pushes packets to an aesd shared memory ring, such as the one aesdsocket
+ * consumes when started with -s.
+ *
+ * Usage: aesdshm-send <ring name> [packet...]
+ * Each packet argument is sent with a trailing newline.  Without packet arguments every
+ * line read from stdin is sent as one packet.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "aesd-shm-ring.h"
+
+static int send_packet(struct aesd_shm_ring *ring, const char *packet, size_t len)
+{
+    int rc = aesd_shm_ring_push(ring, packet, len, -1);
+    if (rc != 0) {
+        fprintf(stderr, "aesd_shm_ring_push: %s\n", strerror(-rc));
+    }
+    return rc;
+}
+
+int main(int argc, char **argv)
+{
+    struct aesd_shm_ring ring;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t len;
+    int rc;
+    int i;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <ring name> [packet...]\n", argv[0]);
+        return 1;
+    }
+    rc = aesd_shm_ring_open(&ring, argv[1]);
+    if (rc != 0) {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(-rc));
+        return 1;
+    }
+    for (i = 2; i < argc && rc == 0; i++) {
+        size_t n = strlen(argv[i]);
+        char *packet = malloc(n + 1);
+        if (packet == NULL) {
+            perror("malloc");
+            rc = -1;
+            break;
+        }
+        memcpy(packet, argv[i], n);
+        packet[n] = '\n';
+        rc = send_packet(&ring, packet, n + 1);
+        free(packet);
+    }
+    while (argc == 2 && rc == 0 && (len = getline(&line, &line_size, stdin)) > 0) {
+        rc = send_packet(&ring, line, len);
+    }
+    free(line);
+    aesd_shm_ring_close(&ring);
+    return rc == 0 ? 0 : 1;
+}
@@ -1,4 +1,6 @@
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/wait.h>
 #include <netdb.h>
 #include <syslog.h>
@@ -13,15 +15,28 @@
 #include <pthread.h>
 #include <sys/queue.h>
 #include <time.h>
+#include <limits.h>
+#include <inttypes.h>
 #include "../aesd-char-driver/aesd_ioctl.h"
+#include "aesd-shm-ring.h"
+#include "aesd-packet-store.h"
+#include "aesd-probes.h"
 
 #define PORT "9000"
 #define BACKLOG 10
+#ifndef USE_AESD_CHAR_DEVICE
 #define USE_AESD_CHAR_DEVICE 1
+#endif
+/* Largest amount handed to one sendfile call while replaying */
+#define SENDFILE_CHUNK (64 * 1024)
+/* How often the shared memory consumer checks for shutdown while idle */
+#define SHM_POLL_MS 500
 
 #if (USE_AESD_CHAR_DEVICE == 1)
      /* This one if debugging is on, and kernel space */
 #    define FILE_NAME "/dev/aesdchar"
+     /* A packet starting with this, followed by X,Y, seeks the device instead of writing */
+#    define AESDCHAR_IOCSEEKTO_CMD "AESDCHAR_IOCSEEKTO:"
 #else
      /* This one for user space */
 #    define FILE_NAME "/var/tmp/aesdsocketdata"
@@ -32,11 +47,27 @@ bool caught_sigterm = false;
 
 pthread_mutex_t read_write_mutex;
 
+/* Name of the shared memory ring to consume packets from, set with -s */
+static const char *shm_ring_name = NULL;
+
+/* What FILE_NAME keeps in user space mode, set with -n, -b and -t */
+static struct aesd_packet_store_limits retention;
+#if (USE_AESD_CHAR_DEVICE == 0)
+static struct aesd_packet_store packet_store;
+
+/* Seconds between timestamp records, set with -i */
+static unsigned int timestamp_interval = 10;
+static pthread_mutex_t timestamp_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timestamp_cond;
+static bool timestamp_stop = false;
+#endif
+
 
 struct node {
     struct data {
         int new_fd;
         char ip_str[INET_ADDRSTRLEN];
+        unsigned long conn_id;
         pthread_t *thread;
     } *data;
     SLIST_ENTRY(node) nodes;
@@ -51,131 +82,455 @@ static void signal_handler(int signal_number) {
     }
 }
 
+/**
+ * Appends the @param len byte packet in @param buf to FILE_NAME as one write
+ * @return 0 on success, -1 on error
+ */
+static int append_packet(const char *buf, size_t len) {
 #if (USE_AESD_CHAR_DEVICE == 0)
-static void timer_thread (union sigval sigval) {
-    char time_string[1024];
-    int rc;
-    time_t t;
-    struct tm *tmp;
-    t = time(NULL);
-    tmp = localtime(&t);
-    rc = strftime(time_string, sizeof(time_string), "timestamp:%a, %d %b %Y %T %z\n", tmp);
-    if (rc == 0) {
-        if (errno != EINTR) {
-            syslog(LOG_ERR, "Error setting time_string with strftime from timer_thread: %s", strerror(errno));
-        }
+    int rc = aesd_packet_store_append(&packet_store, buf, len);
+    if (rc != 0) {
+        syslog(LOG_ERR, "Error appending to %s: %s", FILE_NAME, strerror(-rc));
+        return -1;
     }
+    return 0;
+#else
+    int rc = -1;
+
+    AESD_PROBE1(lock_wait, &read_write_mutex);
     if ( pthread_mutex_lock(&read_write_mutex) != 0 ) {
-        if (errno != EINTR) {
-            syslog(LOG_ERR, "Error %d (%s) locking thread data!",errno,strerror(errno));
-        }
+        syslog(LOG_ERR, "Error %d (%s) locking thread data!",errno,strerror(errno));
+        return -1;
+    }
+    AESD_PROBE1(lock_acquired, &read_write_mutex);
+    FILE *file_to_write = fopen(FILE_NAME, "a+");
+    if (file_to_write == NULL) {
+        syslog(LOG_ERR, "Error opening %s: %s", FILE_NAME, strerror(errno));
     } else {
-        FILE *file_to_write = fopen(FILE_NAME, "a+");
-        fwrite(time_string, sizeof time_string[0], strlen(time_string), file_to_write);
-        fclose(file_to_write);
-        if ( pthread_mutex_unlock(&read_write_mutex) != 0 ) {
-            if (errno != EINTR) {
-                syslog(LOG_ERR, "Error %d (%s) unlocking thread data!\n",errno,strerror(errno));
-            }
+        if (fwrite(buf, sizeof buf[0], len, file_to_write) == len) {
+            rc = 0;
+        }
+        if (fclose(file_to_write) != 0) {
+            rc = -1;
+        }
+        if (rc != 0) {
+            syslog(LOG_ERR, "Error appending to %s: %s", FILE_NAME, strerror(errno));
+        }
+    }
+    if ( pthread_mutex_unlock(&read_write_mutex) != 0 ) {
+        syslog(LOG_ERR, "Error %d (%s) unlocking thread data!\n",errno,strerror(errno));
+    }
+    AESD_PROBE1(lock_released, &read_write_mutex);
+    return rc;
+#endif
+}
+
+/**
+ * Appends packets pushed to the shared memory ring @param thread_param by local producers
+ * until a signal asks aesdsocket to exit
+ */
+static void* shm_consumer_thread(void* thread_param) {
+    struct aesd_shm_ring *ring = thread_param;
+    size_t buf_size = ring->hdr->capacity;
+    char *buf = malloc(buf_size);
+    ssize_t len;
+
+    if (buf == NULL) {
+        syslog(LOG_ERR, "Error allocating the shared memory packet buffer");
+        return NULL;
+    }
+    while (!caught_sigint && !caught_sigterm) {
+        len = aesd_shm_ring_pop(ring, buf, buf_size, SHM_POLL_MS);
+        if (len >= 0) {
+            append_packet(buf, len);
+        }
+        else if (len != -ETIMEDOUT) {
+            syslog(LOG_ERR, "Error reading shared memory ring %s: %s", shm_ring_name, strerror(-len));
+            break;
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+#if (USE_AESD_CHAR_DEVICE == 0)
+/**
+ * The formatted timestamp record of one wall clock second
+ */
+struct timestamp_cache {
+    time_t t;
+    size_t len;
+    char text[64];
+};
+
+/**
+ * Formats the record for wall clock second @param t into @param cache unless it holds it
+ * already.  On error cache->len is 0.
+ */
+static void timestamp_cache_update(struct timestamp_cache *cache, time_t t) {
+    struct tm tm;
+
+    if (cache->len != 0 && cache->t == t) {
+        return;
+    }
+    cache->t = t;
+    cache->len = 0;
+    if (localtime_r(&t, &tm) == NULL) {
+        syslog(LOG_ERR, "Error converting the time for a timestamp: %s", strerror(errno));
+        return;
+    }
+    cache->len = strftime(cache->text, sizeof(cache->text), "timestamp:%a, %d %b %Y %T %z\n", &tm);
+    if (cache->len == 0) {
+        syslog(LOG_ERR, "Error formatting a timestamp with strftime");
+    }
+}
+
+/**
+ * Appends a timestamp record every timestamp_interval seconds until timestamp_stop is set.
+ * One thread serves every tick.  Each record is formatted while waiting for its tick,
+ * for the wall clock second the tick is due in, so a tick only appends it, and is only
+ * formatted again if the wall clock moved meanwhile.
+ */
+static void* timestamp_thread(void* thread_param) {
+    struct timestamp_cache cache = { .len = 0 };
+    struct timespec deadline, now, wall;
+    long long ahead_ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    pthread_mutex_lock(&timestamp_mutex);
+    while (!timestamp_stop) {
+        deadline.tv_sec += timestamp_interval;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        clock_gettime(CLOCK_REALTIME, &wall);
+        ahead_ns = (deadline.tv_sec - now.tv_sec) * 1000000000LL + (deadline.tv_nsec - now.tv_nsec);
+        timestamp_cache_update(&cache, wall.tv_sec + (wall.tv_nsec + ahead_ns) / 1000000000LL);
+        while (!timestamp_stop &&
+               pthread_cond_timedwait(&timestamp_cond, &timestamp_mutex, &deadline) != ETIMEDOUT) {
+        }
+        if (timestamp_stop) {
+            break;
+        }
+        pthread_mutex_unlock(&timestamp_mutex);
+
+        clock_gettime(CLOCK_REALTIME, &wall);
+        timestamp_cache_update(&cache, wall.tv_sec);
+        if (cache.len != 0) {
+            append_packet(cache.text, cache.len);
         }
+        // after a stall, such as an append stuck behind a slow disk, skip the missed ticks instead of bursting
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec - deadline.tv_sec >= (time_t)timestamp_interval) {
+            deadline = now;
+        }
+        pthread_mutex_lock(&timestamp_mutex);
     }
+    pthread_mutex_unlock(&timestamp_mutex);
+    return thread_param;
+}
+
+/**
+ * Starts timestamp_thread in @param thread
+ * @return true on success
+ */
+static bool start_timestamps(pthread_t *thread) {
+    pthread_condattr_t attr;
+    int rc;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&timestamp_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    rc = pthread_create(thread, NULL, timestamp_thread, NULL);
+    if (rc != 0) {
+        syslog(LOG_ERR, "Error starting the timestamp thread: %s", strerror(rc));
+        pthread_cond_destroy(&timestamp_cond);
+        return false;
+    }
+    return true;
+}
+
+static void stop_timestamps(pthread_t thread) {
+    pthread_mutex_lock(&timestamp_mutex);
+    timestamp_stop = true;
+    pthread_cond_signal(&timestamp_cond);
+    pthread_mutex_unlock(&timestamp_mutex);
+    pthread_join(thread, NULL);
+    pthread_cond_destroy(&timestamp_cond);
 }
 #endif
 #if (USE_AESD_CHAR_DEVICE == 0)
-static bool setup_timer( int clock_id,
-                         timer_t timerid, unsigned int timer_period,
-                         struct timespec *start_time)
-{
-    bool success = false;
-    if ( timer_period == 0 ) {
-        syslog(LOG_ERR, "Unsupported timer period (must be non-zero)");
-    } else {
-        if ( clock_gettime(clock_id,start_time) != 0 ) {
-            syslog(LOG_ERR, "Error %d (%s) getting clock %d time\n",errno,strerror(errno),clock_id);
-        } else {
-            struct itimerspec itimerspec;
-            memset(&itimerspec, 0, sizeof(struct itimerspec));
-            itimerspec.it_interval.tv_sec = timer_period;
-            itimerspec.it_interval.tv_nsec = 0;
-            itimerspec.it_value.tv_sec = start_time->tv_sec + 
-                                         itimerspec.it_interval.tv_sec;
-            if( timer_settime(timerid, TIMER_ABSTIME, &itimerspec, NULL ) != 0 ) {
-                syslog(LOG_ERR, "Error %d (%s) setting timer\n",errno,strerror(errno));
-            } else {
-                success = true;
+/**
+ * Sends bytes @param start to @param end of @param fd to @param sockfd without moving the
+ * file position, falling back to pread and send through @param buf when the file cannot
+ * be spliced
+ * @return 0 on success, -1 with errno set on error
+ */
+static int send_file_range(int sockfd, int fd, off_t start, off_t end, char *buf, int buf_size) {
+    ssize_t byte_count = 0;
+
+    while (start < end) {
+        byte_count = sendfile(sockfd, fd, &start, end - start > SENDFILE_CHUNK ? SENDFILE_CHUNK : end - start);
+        if (byte_count <= 0 && !(byte_count == -1 && errno == EINTR)) {
+            break;
+        }
+    }
+    if (start >= end) {
+        return 0;
+    }
+    if (byte_count == 0) {
+        errno = EIO;
+        return -1;
+    }
+    if (errno != EINVAL && errno != ENOSYS) {
+        return -1;
+    }
+    while (start < end) {
+        byte_count = pread(fd, buf, end - start > buf_size ? buf_size : end - start, start);
+        if (byte_count <= 0) {
+            if (byte_count == 0) {
+                errno = EIO;
             }
+            return -1;
         }
+        if (send(sockfd, buf, byte_count, MSG_MORE) == -1) {
+            return -1;
+        }
+        start += byte_count;
     }
-    return success;
+    return 0;
 }
-#endif
-void* read_write_thread(void* thread_param) {
-    int buf_size = 1024;
-    char *buf = malloc(buf_size * sizeof(char));
-    int rc, byte_count, err_val;
-    struct data* thread_args = (struct data*) thread_param;
 
-    syslog(LOG_DEBUG, "Accepted connection to %s\n", thread_args->ip_str);
-    rc = pthread_mutex_lock(&read_write_mutex);
-    FILE *file_to_write = fopen(FILE_NAME, "a+");
-    if (!file_to_write) {
-        err_val = errno;
-        if (errno != EINTR) {
-            syslog(LOG_ERR, "Error opening /var/tmp/aesdsocketdata: %s", strerror(err_val));
-            free(buf);
-            pthread_exit(thread_param);
+/**
+ * Receives from @param sockfd until a newline or the end of the connection, so a packet
+ * arriving in several segments is appended as one
+ * @return the malloc'd packet, its length in @param len_rtn, or NULL on error
+ */
+static char *receive_packet(int sockfd, size_t *len_rtn) {
+    size_t size = 1024;
+    size_t len = 0;
+    char *packet = malloc(size);
+    ssize_t byte_count;
+
+    while (packet != NULL) {
+        if (len == size) {
+            char *bigger = realloc(packet, size * 2);
+            if (bigger == NULL) {
+                syslog(LOG_ERR, "Error growing the packet buffer past %zu bytes", size);
+                break;
+            }
+            packet = bigger;
+            size *= 2;
+        }
+        byte_count = recv(sockfd, packet + len, size - len, 0);
+        if (byte_count == -1) {
+            if (errno == EINTR && !caught_sigint && !caught_sigterm) {
+                continue;
+            }
+            syslog(LOG_ERR, "Error receiving a packet: %s", strerror(errno));
+            break;
+        }
+        len += byte_count;
+        if (byte_count == 0 || memchr(packet + len - byte_count, '\n', byte_count) != NULL) {
+            *len_rtn = len;
+            return packet;
         }
     }
+    free(packet);
+    return NULL;
+}
+
+/**
+ * Appends the packet received from @param thread_args to the packet store and replays
+ * what the store retains.  The replay holds no lock, so it neither waits for nor delays
+ * other connections, the timer or the compactor.
+ */
+static void exchange_with_store(struct data *thread_args, char *buf, int buf_size) {
+    size_t len;
+    char *packet = receive_packet(thread_args->new_fd, &len);
+    off_t start, end;
+    int fd, rc;
+
+    if (packet == NULL) {
+        return;
+    }
+    AESD_PROBE2(packet_framed, thread_args->conn_id, len);
+    if (len > 0 && append_packet(packet, len) != 0) {
+        free(packet);
+        return;
+    }
+    free(packet);
+    AESD_PROBE2(append_done, thread_args->conn_id, len);
+    rc = aesd_packet_store_snapshot(&packet_store, &fd, &start, &end);
     if (rc != 0) {
-        err_val = errno;
-        if (errno != EINTR) {
-            syslog(LOG_ERR, "Error locking mutex for read_write_thread: %s", strerror(err_val));
-            free(buf);
-            pthread_exit(thread_param);
+        syslog(LOG_ERR, "Error opening %s for replay: %s", FILE_NAME, strerror(-rc));
+        return;
+    }
+    if (send_file_range(thread_args->new_fd, fd, start, end, buf, buf_size) != 0) {
+        syslog(LOG_ERR, "Error sending %s to %s: %s", FILE_NAME, thread_args->ip_str, strerror(errno));
+    }
+    else {
+        AESD_PROBE2(replay_done, thread_args->conn_id, end - start);
+    }
+    close(fd);
+}
+#else
+/**
+ * Sends the contents of @param file from its current position to end of file to @param sockfd.
+ * Uses sendfile so the kernel moves the data straight to the socket, falling back to
+ * read and send through @param buf when the file cannot be spliced.
+ * @return the number of bytes sent, -1 with errno set on error
+ */
+static ssize_t send_file_contents(int sockfd, FILE *file, char *buf, int buf_size) {
+    int fd = fileno(file);
+    ssize_t byte_count;
+    ssize_t sent = 0;
+
+    // sendfile works on the descriptor, so nothing may be left in the stdio buffer
+    if (fflush(file) != 0) {
+        return -1;
+    }
+    do {
+        byte_count = sendfile(sockfd, fd, NULL, SENDFILE_CHUNK);
+        if (byte_count > 0) {
+            sent += byte_count;
         }
+    } while (byte_count > 0 || (byte_count == -1 && errno == EINTR));
+    if (byte_count == 0) {
+        return sent;
+    }
+    if (errno != EINVAL && errno != ENOSYS) {
+        return -1;
     }
+    while ((byte_count = read(fd, buf, buf_size)) > 0) {
+        if (send(sockfd, buf, byte_count, MSG_MORE) == -1) {
+            return -1;
+        }
+        sent += byte_count;
+    }
+    return byte_count == 0 ? sent : -1;
+}
+
+/**
+ * Handles one received block: an AESDCHAR_IOCSEEKTO:X,Y command becomes the ioctl which
+ * moves the file position, anything else is appended to @param file
+ * @return true if the block was a seek command
+ */
+static bool write_block(FILE *file, const char *buf, int byte_count) {
+    size_t cmd_len = strlen(AESDCHAR_IOCSEEKTO_CMD);
+    struct aesd_seekto seekto;
+    char cmd[64];
+
+    if ((size_t)byte_count < cmd_len || memcmp(buf, AESDCHAR_IOCSEEKTO_CMD, cmd_len) != 0) {
+        fwrite(buf, sizeof buf[0], byte_count, file);
+        return false;
+    }
+    // the received bytes are not NUL terminated
+    snprintf(cmd, sizeof(cmd), "%.*s", byte_count, buf);
+    if (sscanf(cmd + cmd_len, "%" SCNu32 ",%" SCNu32, &seekto.write_cmd, &seekto.write_cmd_offset) != 2) {
+        syslog(LOG_ERR, "Malformed %s command", AESDCHAR_IOCSEEKTO_CMD);
+        return true;
+    }
+    syslog(LOG_DEBUG, "write_cmd: %" PRIu32 " write_cmd_offset: %" PRIu32, seekto.write_cmd, seekto.write_cmd_offset);
+    fflush(file);
+    if (ioctl(fileno(file), AESDCHAR_IOCSEEKTO, &seekto) == -1) {
+        syslog(LOG_ERR, "Error seeking %s: %s", FILE_NAME, strerror(errno));
+    }
+    return true;
+}
+
+/**
+ * Writes the packet received from @param thread_args to @param file, which is opened under
+ * read_write_mutex, and replays the device contents back to the client
+ */
+static void exchange_with_file(struct data *thread_args, FILE *file, char *buf, int buf_size) {
+    int byte_count;
+    size_t received = 0;
+    ssize_t sent;
     bool ioctl_cmd_sent = false;
-    do {
+
+    for (;;) {
         byte_count = recv(thread_args->new_fd, buf, buf_size, 0);
-        if(strncmp(buf, "AESDCHAR_IOCSEEKTO:", strlen("AESDCHAR_IOCSEEKTO:")) == 0) {
-            struct aesd_seekto seekto;
-            char * string_to_parse = strstr(buf, ":");
-            sscanf(string_to_parse, ":%d,%d", &seekto.write_cmd, &seekto.write_cmd_offset);
-            syslog(LOG_DEBUG, "write_cmd: %d write_cmd_offset: %d", seekto.write_cmd, seekto.write_cmd_offset);
-            ioctl(fileno(file_to_write), AESDCHAR_IOCSEEKTO, &seekto);
+        if (byte_count == -1 && errno == EINTR) {
+            continue;
+        }
+        // a closed connection or a receive error ends the packet
+        if (byte_count == -1) {
+            syslog(LOG_ERR, "Error receiving from %s: %s", thread_args->ip_str, strerror(errno));
+        }
+        if (byte_count <= 0) {
+            break;
+        }
+        received += byte_count;
+        if (write_block(file, buf, byte_count)) {
             ioctl_cmd_sent = true;
         }
-        else {
-            fwrite(buf, sizeof buf[0], byte_count, file_to_write);
+        if (byte_count < buf_size) {
+            break;
         }
     }
-    while(byte_count == buf_size);
+    AESD_PROBE2(packet_framed, thread_args->conn_id, received);
     if (!ioctl_cmd_sent) {
-        rewind(file_to_write);
+        rewind(file);
+        AESD_PROBE2(append_done, thread_args->conn_id, received);
+    }
+
+    sent = send_file_contents(thread_args->new_fd, file, buf, buf_size);
+    if (sent == -1) {
+        syslog(LOG_ERR, "Error sending %s to %s: %s", FILE_NAME, thread_args->ip_str, strerror(errno));
+    }
+    else {
+        AESD_PROBE2(replay_done, thread_args->conn_id, sent);
     }
+}
+
+static void exchange_with_device(struct data *thread_args, char *buf, int buf_size) {
+    FILE *file_to_write;
+    int rc;
 
-    byte_count = fread(buf, sizeof buf[0], buf_size, file_to_write);
-    send(thread_args->new_fd, buf, byte_count, MSG_MORE);
-    while (byte_count == buf_size) {
-        byte_count = fread(buf, sizeof buf[0], buf_size, file_to_write);
-        send(thread_args->new_fd, buf, byte_count, MSG_MORE);
+    AESD_PROBE1(lock_wait, &read_write_mutex);
+    rc = pthread_mutex_lock(&read_write_mutex);
+    if (rc != 0) {
+        syslog(LOG_ERR, "Error locking mutex for read_write_thread: %s", strerror(rc));
+        return;
+    }
+    AESD_PROBE1(lock_acquired, &read_write_mutex);
+    file_to_write = fopen(FILE_NAME, "a+");
+    if (file_to_write == NULL) {
+        syslog(LOG_ERR, "Error opening %s: %s", FILE_NAME, strerror(errno));
+    }
+    else {
+        exchange_with_file(thread_args, file_to_write, buf, buf_size);
+        fclose(file_to_write);
     }
     rc = pthread_mutex_unlock(&read_write_mutex);
     if (rc != 0) {
-        err_val = errno;
-        if (errno != EINTR) {
-            syslog(LOG_ERR, "Error unlocking mutex for read_write_thread: %s", strerror(err_val));
-            free(buf);
-            pthread_exit(thread_param);
-        } 
+        syslog(LOG_ERR, "Error unlocking mutex for read_write_thread: %s", strerror(rc));
+        return;
     }
+    AESD_PROBE1(lock_released, &read_write_mutex);
+}
+#endif
+
+void* read_write_thread(void* thread_param) {
+    int buf_size = 1024;
+    char *buf = malloc(buf_size * sizeof(char));
+    struct data* thread_args = (struct data*) thread_param;
+
+    AESD_PROBE1(conn_start, thread_args->conn_id);
+    syslog(LOG_DEBUG, "Accepted connection to %s\n", thread_args->ip_str);
+#if (USE_AESD_CHAR_DEVICE == 0)
+    exchange_with_store(thread_args, buf, buf_size);
+#else
+    exchange_with_device(thread_args, buf, buf_size);
+#endif
     shutdown(thread_args->new_fd, 2);
     syslog(LOG_DEBUG, "Closed connection to %s\n", thread_args->ip_str);
-    fclose(file_to_write);
+    AESD_PROBE1(conn_close, thread_args->conn_id);
     free(buf);
     return thread_param;
 }
 
+
 int send_and_receive(void) {
     int sockfd; 
     struct addrinfo hints, *res;
@@ -187,9 +542,14 @@ int send_and_receive(void) {
     SLIST_HEAD(head_s, node) head;
     SLIST_INIT(&head);
 
+    struct aesd_shm_ring shm_ring;
+    pthread_t shm_thread;
+    bool shm_started = false;
+
     struct node * new_node = NULL;
     struct data * new_data = NULL;
     pthread_t * new_thread = NULL;
+    unsigned long conn_count = 0;
 
     memset(&hints, 0, sizeof hints);
     hints.ai_family = AF_INET;
@@ -197,12 +557,9 @@ int send_and_receive(void) {
     hints.ai_flags = AI_PASSIVE;
 
 #if (USE_AESD_CHAR_DEVICE == 0)
-    timer_t timerid;
-    struct sigevent sev;
-    memset(&sev,0,sizeof(struct sigevent));
-    sev.sigev_notify = SIGEV_THREAD;
-    sev.sigev_notify_function = timer_thread;
-#endif 
+    pthread_t timestamp_tid;
+    bool timestamps_started = false;
+#endif
     int yes=1;
 
     getaddrinfo(NULL, PORT, &hints, &res);
@@ -240,17 +597,26 @@ int send_and_receive(void) {
     
     freeaddrinfo(res);
 #if (USE_AESD_CHAR_DEVICE == 0)
-    int clock_id = CLOCK_MONOTONIC;
-    if ( timer_create(clock_id,&sev,&timerid) != 0 ) {
-        syslog(LOG_ERR, "Error %d (%s) creating timer!\n",errno,strerror(errno));
-    } else {
-        struct timespec start_time;
-        start_time.tv_sec = 10;
-        int timer_period = 10;
-        if ( setup_timer(clock_id, timerid, timer_period, &start_time) ) {
-        }
+    int store_rc = aesd_packet_store_open(&packet_store, FILE_NAME, &retention);
+    if (store_rc != 0) {
+        syslog(LOG_ERR, "Error opening %s: %s", FILE_NAME, strerror(-store_rc));
+        closelog();
+        return -1;
     }
+    timestamps_started = start_timestamps(&timestamp_tid);
 #endif
+    if (shm_ring_name != NULL) {
+        int rc = aesd_shm_ring_create(&shm_ring, shm_ring_name, AESD_SHM_RING_DEFAULT_CAPACITY);
+        if (rc != 0) {
+            syslog(LOG_ERR, "Error creating shared memory ring %s: %s", shm_ring_name, strerror(-rc));
+        } else if (pthread_create(&shm_thread, NULL, shm_consumer_thread, &shm_ring) != 0) {
+            syslog(LOG_ERR, "Error starting the shared memory consumer thread");
+            aesd_shm_ring_close(&shm_ring);
+            shm_unlink(shm_ring_name);
+        } else {
+            shm_started = true;
+        }
+    }
     do {
         if (listen(sockfd, BACKLOG) == -1) {
             err_val = errno;
@@ -278,6 +644,8 @@ int send_and_receive(void) {
         }
         inet_ntop(AF_INET, &their_addr.sin_addr, new_data->ip_str, INET_ADDRSTRLEN);
         new_data->new_fd = new_fd;
+        new_data->conn_id = ++conn_count;
+        AESD_PROBE2(conn_accept, new_data->conn_id, new_fd);
         new_thread = malloc(sizeof(pthread_t));
         new_data->thread = new_thread;
         new_node->data = new_data;
@@ -291,6 +659,7 @@ int send_and_receive(void) {
     }
     while(!caught_sigint && !caught_sigterm);
     syslog(LOG_DEBUG, "Caught signal, exiting");
+#if (USE_AESD_CHAR_DEVICE == 1)
     if (remove(FILE_NAME) == -1) {
         int err_val = errno;
         if (errno != EINTR) {
@@ -298,6 +667,7 @@ int send_and_receive(void) {
             closelog();
         }
     }
+#endif
     SLIST_FOREACH(new_node, &head, nodes) {
         pthread_join(*new_node->data->thread, (void**)new_node->data);
     }
@@ -314,20 +684,39 @@ int send_and_receive(void) {
         new_node = NULL;
     }
     SLIST_INIT(&head);
+    if (shm_started) {
+        pthread_join(shm_thread, NULL);
+        aesd_shm_ring_close(&shm_ring);
+        shm_unlink(shm_ring_name);
+    }
 #if (USE_AESD_CHAR_DEVICE == 0)
-    if(timer_delete(timerid) != 0) {
-        if (errno != EINTR) {
-            syslog(LOG_ERR, "Error deleting timer: %s", strerror(err_val));
-        }
+    if (timestamps_started) {
+        stop_timestamps(timestamp_tid);
     }
+    aesd_packet_store_close(&packet_store, true);
 #endif
     shutdown(sockfd, 2);
     return 0;
 }
 
+/**
+ * Parses the retention option @param arg into @param value_rtn
+ * @return false unless it is a positive number no larger than @param max
+ */
+static bool parse_limit(const char *arg, unsigned long long max, unsigned long long *value_rtn) {
+    char *end;
+
+    errno = 0;
+    *value_rtn = strtoull(arg, &end, 10);
+    return errno == 0 && end != arg && *end == '\0' && arg[0] != '-' && *value_rtn > 0 &&
+           *value_rtn <= max;
+}
+
 int main(int argc, char* argv[]) {
     pid_t childpid;
     bool daemon = false;
+    int opt;
+    unsigned long long limit;
 
     struct sigaction new_action;
 
@@ -346,15 +735,73 @@ int main(int argc, char* argv[]) {
         closelog();
         return -1;
     }
+    // a client closing before its replay ends must fail the send, not kill the server
+    new_action.sa_handler = SIG_IGN;
+    if (sigaction(SIGPIPE, &new_action, NULL) != 0) {
+        int err_val = errno;
+        syslog(LOG_ERR, "Error ignoring SIGPIPE: %s", strerror(err_val));
+        closelog();
+        return -1;
+    }
     
-    if (argc >= 2) {
-        if (strcmp(argv[1],"-d") == 0) {
-            daemon = true;
-            syslog(LOG_DEBUG, "Starting in daemon mode.");
+    while ((opt = getopt(argc, argv, "ds:n:b:t:i:")) != -1) {
+        switch (opt) {
+            case 'd':
+                daemon = true;
+                break;
+            case 's':
+                shm_ring_name = optarg;
+                break;
+            case 'n':
+                if (!parse_limit(optarg, AESD_PACKET_INDEX_CAPACITY, &limit)) {
+                    fprintf(stderr, "%s: -n takes a packet count from 1 to %u\n", argv[0],
+                            AESD_PACKET_INDEX_CAPACITY);
+                    closelog();
+                    return -1;
+                }
+                retention.max_packets = limit;
+                break;
+            case 'b':
+                if (!parse_limit(optarg, SIZE_MAX, &limit)) {
+                    fprintf(stderr, "%s: -b takes a positive byte count\n", argv[0]);
+                    closelog();
+                    return -1;
+                }
+                retention.max_bytes = limit;
+                break;
+            case 't':
+                if (!parse_limit(optarg, UINT_MAX, &limit)) {
+                    fprintf(stderr, "%s: -t takes a positive number of seconds\n", argv[0]);
+                    closelog();
+                    return -1;
+                }
+                retention.max_age_s = limit;
+                break;
+            case 'i':
+                if (!parse_limit(optarg, UINT_MAX, &limit)) {
+                    fprintf(stderr, "%s: -i takes a positive number of seconds\n", argv[0]);
+                    closelog();
+                    return -1;
+                }
+#if (USE_AESD_CHAR_DEVICE == 0)
+                timestamp_interval = limit;
+#else
+                syslog(LOG_WARNING, "Ignoring -i, timestamps are only written in user space mode");
+#endif
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-d] [-s shm ring name] [-n packets] [-b bytes] [-t seconds] [-i seconds]\n",
+                        argv[0]);
+                closelog();
+                return -1;
         }
-    } else {
-        syslog(LOG_DEBUG, "Starting in user mode.");
     }
+#if (USE_AESD_CHAR_DEVICE == 1)
+    if (retention.max_packets != 0 || retention.max_bytes != 0 || retention.max_age_s != 0) {
+        syslog(LOG_WARNING, "Ignoring -n, -b and -t, %s keeps only its last writes anyway", FILE_NAME);
+    }
+#endif
+    syslog(LOG_DEBUG, daemon ? "Starting in daemon mode." : "Starting in user mode.");
 
     if(daemon) {
         switch(childpid = fork()) {
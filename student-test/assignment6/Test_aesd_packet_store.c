@@ -0,0 +1,244 @@
+#include "unity.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "../../server/aesd-packet-store.h"
+
+/**
+ * Drives the aesdsocket packet store through its API: retention by packet count, bytes
+ * and age, compaction while a replay still holds the old file, and reopening a file
+ * written earlier.
+ */
+
+#define TEST_STORE_POLL_MS 10
+#define TEST_STORE_TIMEOUT_MS 5000
+
+/**
+ * Creates an empty directory for one test and returns the path of a store file in it
+ */
+static void test_store_path(char *dir, size_t dir_size, char *path, size_t path_size)
+{
+    snprintf(dir, dir_size, "/tmp/aesd-packet-store-XXXXXX");
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    snprintf(path, path_size, "%s/data", dir);
+}
+
+static void test_sleep_ms(long ms)
+{
+    struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000 };
+    nanosleep(&ts, NULL);
+}
+
+/**
+ * @return the malloc'd, NUL terminated bytes @param start to @param end of @param fd
+ */
+static char *test_read_range(int fd, off_t start, off_t end)
+{
+    char *buf = malloc(end - start + 1);
+    off_t pos = start;
+
+    TEST_ASSERT_NOT_NULL(buf);
+    while (pos < end) {
+        ssize_t rc = pread(fd, buf + (pos - start), end - pos, pos);
+        TEST_ASSERT_TRUE(rc > 0);
+        pos += rc;
+    }
+    buf[end - start] = '\0';
+    return buf;
+}
+
+/**
+ * Checks that a snapshot of @param store returns exactly @param expected
+ */
+static void test_assert_retained(struct aesd_packet_store *store, const char *expected)
+{
+    off_t start, end;
+    char *retained;
+    int fd;
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_packet_store_snapshot(store, &fd, &start, &end));
+    retained = test_read_range(fd, start, end);
+    TEST_ASSERT_EQUAL_STRING(expected, retained);
+    free(retained);
+    close(fd);
+}
+
+static void test_append_string(struct aesd_packet_store *store, const char *packet)
+{
+    TEST_ASSERT_EQUAL_INT(0, aesd_packet_store_append(store, packet, strlen(packet)));
+}
+
+void test_aesd_packet_store_unlimited_keeps_everything()
+{
+    struct aesd_packet_store store;
+    char dir[64], path[80];
+
+    test_store_path(dir, sizeof(dir), path, sizeof(path));
+    TEST_ASSERT_EQUAL_INT(0, aesd_packet_store_open(&store, path, NULL));
+    test_assert_retained(&store, "");
+    test_append_string(&store, "one\n");
+    test_append_string(&store, "two\n");
+    test_append_string(&store, "three\n");
+    test_assert_retained(&store, "one\ntwo\nthree\n");
+    aesd_packet_store_close(&store, true);
+    TEST_ASSERT_EQUAL_INT(-1, access(path, F_OK));
+    rmdir(dir);
+}
+
+void test_aesd_packet_store_max_packets()
+{
+    struct aesd_packet_store_limits limits = { .max_packets = 3 };
+    struct aesd_packet_store store;
+    char dir[64], path[80];
+
+    test_store_path(dir, sizeof(dir), path, sizeof(path));
+    TEST_ASSERT_EQUAL_INT(0, aesd_packet_store_open(&store, path, &limits));
+    test_append_string(&store, "1\n");
+    test_append_string(&store, "2\n");
+    test_append_string(&store, "3\n");
+    test_assert_retained(&store, "1\n2\n3\n");
+    test_append_string(&store, "4\n");
+    test_append_string(&store, "5\n");
+    test_assert_retained(&store, "3\n4\n5\n");
+    aesd_packet_store_close(&store, true);
+    rmdir(dir);
+}
+
+void test_aesd_packet_store_max_bytes()
+{
+    struct aesd_packet_store_limits limits = { .max_bytes = 10 };
+    struct aesd_packet_store store;
+    char dir[64], path[80];
+
+    test_store_path(dir, sizeof(dir), path, sizeof(path));
+    TEST_ASSERT_EQUAL_INT(0, aesd_packet_store_open(&store, path, &limits));
+    test_append_string(&store, "abcd\n");
+    test_append_string(&store, "efgh\n");
+    test_assert_retained(&store, "abcd\nefgh\n");
+    test_append_string(&store, "ij\n");
+    test_assert_retained(&store, "efgh\nij\n");
+    // the newest packet is kept even when it alone exceeds the limit
+    test_append_string(&store, "a packet longer than ten bytes\n");
+    test_assert_retained(&store, "a packet longer than ten bytes\n");
+    aesd_packet_store_close(&store, true);
+    rmdir(dir);
+}
+
+void test_aesd_packet_store_max_age()
+{
+    struct aesd_packet_store_limits limits = { .max_age_s = 1 };
+    struct aesd_packet_store store;
+    char dir[64], path[80];
+    off_t start, end;
+    int waited;
+    int fd;
+
+    test_store_path(dir, sizeof(dir), path, sizeof(path));
+    TEST_ASSERT_EQUAL_INT(0, aesd_packet_store_open(&store, path, &limits));
+    test_append_string(&store, "old\n");
+    // the compactor thread expires packets without any further append
+    for (waited = 0; waited < TEST_STORE_TIMEOUT_MS; waited += TEST_STORE_POLL_MS) {
+        TEST_ASSERT_EQUAL_INT(0, aesd_packet_store_snapshot(&store, &fd, &start, &end));
+        close(fd);
+        if (start == end) {
+            break;
+        }
+        test_sleep_ms(TEST_STORE_POLL_MS);
+    }
+    TEST_ASSERT_EQUAL_INT(start, end);
+    test_append_string(&store, "new\n");
+    test_assert_retained(&store, "new\n");
+    aesd_packet_store_close(&store, true);
+    rmdir(dir);
+}
+
+/**
+ * Appends enough dropped data for a compaction while an earlier snapshot is still open,
+ * as a replay in progress would be
+ */
+void test_aesd_packet_store_compaction_keeps_snapshots_readable()
+{
+    struct aesd_packet_store_limits limits = { .max_packets = 4 };
+    struct aesd_packet_store store;
+    char dir[64], path[80];
+    char packet[1024];
+    char expected[4 * sizeof(packet) + 1];
+    char *before;
+    char *retained;
+    struct stat st;
+    off_t start, end;
+    int packets = 2 * AESD_PACKET_STORE_COMPACT_MIN / sizeof(packet);
+    int waited;
+    int fd;
+
+    test_store_path(dir, sizeof(dir), path, sizeof(path));
+    TEST_ASSERT_EQUAL_INT(0, aesd_packet_store_open(&store, path, &limits));
+    for (int i = 0; i < 4; i++) {
+        memset(packet, 'a' + i, sizeof(packet) - 1);
+        packet[sizeof(packet) - 1] = '\n';
+        TEST_ASSERT_EQUAL_INT(0, aesd_packet_store_append(&store, packet, sizeof(packet)));
+    }
+    TEST_ASSERT_EQUAL_INT(0, aesd_packet_store_snapshot(&store, &fd, &start, &end));
+    before = test_read_range(fd, start, end);
+
+    for (int i = 0; i < packets; i++) {
+        memset(packet, 'a' + i % 26, sizeof(packet) - 1);
+        TEST_ASSERT_EQUAL_INT(0, aesd_packet_store_append(&store, packet, sizeof(packet)));
+        if (i >= packets - 4) {
+            memcpy(expected + (i - (packets - 4)) * sizeof(packet), packet, sizeof(packet));
+        }
+    }
+    expected[sizeof(expected) - 1] = '\0';
+    for (waited = 0; waited < TEST_STORE_TIMEOUT_MS; waited += TEST_STORE_POLL_MS) {
+        TEST_ASSERT_EQUAL_INT(0, stat(path, &st));
+        if (st.st_size < AESD_PACKET_STORE_COMPACT_MIN) {
+            break;
+        }
+        test_sleep_ms(TEST_STORE_POLL_MS);
+    }
+    TEST_ASSERT_EQUAL_INT(sizeof(expected) - 1, st.st_size);
+    test_assert_retained(&store, expected);
+
+    // the snapshot taken before the compaction still reads the file it started with
+    retained = test_read_range(fd, start, end);
+    TEST_ASSERT_EQUAL_STRING(before, retained);
+    free(retained);
+    free(before);
+    close(fd);
+    aesd_packet_store_close(&store, true);
+    rmdir(dir);
+}
+
+void test_aesd_packet_store_reopen_existing_file()
+{
+    struct aesd_packet_store_limits limits = { .max_packets = 2 };
+    struct aesd_packet_store store;
+    char dir[64], path[80];
+    int fd;
+
+    test_store_path(dir, sizeof(dir), path, sizeof(path));
+    fd = open(path, O_WRONLY | O_CREAT, 0644);
+    TEST_ASSERT_TRUE(fd != -1);
+    TEST_ASSERT_EQUAL_INT(11, write(fd, "a\nbb\nccc\ndd", 11));
+    close(fd);
+
+    // without limits the whole file is retained and appends follow it
+    TEST_ASSERT_EQUAL_INT(0, aesd_packet_store_open(&store, path, NULL));
+    test_assert_retained(&store, "a\nbb\nccc\ndd");
+    test_append_string(&store, "d\n");
+    test_assert_retained(&store, "a\nbb\nccc\nddd\n");
+    aesd_packet_store_close(&store, false);
+
+    // with limits every existing line counts as one packet
+    TEST_ASSERT_EQUAL_INT(0, aesd_packet_store_open(&store, path, &limits));
+    test_assert_retained(&store, "ccc\nddd\n");
+    test_append_string(&store, "e\n");
+    test_assert_retained(&store, "ddd\ne\n");
+    aesd_packet_store_close(&store, true);
+    rmdir(dir);
+}
@@ -0,0 +1,107 @@
+#include "unity.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-circular-arena.h"
+
+/**
+ * Checks aesd-circular-arena against a model of the bytes it should retain: the newest
+ * entries which fit in the arena, concatenated.
+ */
+
+#define TEST_ARENA_CAPACITY 64
+#define TEST_ARENA_OPERATIONS 5000
+
+struct test_arena_model
+{
+    size_t sizes[TEST_ARENA_OPERATIONS];
+    /* Every byte ever added, the retained entries being [first, last) of sizes */
+    char stream[TEST_ARENA_OPERATIONS * TEST_ARENA_CAPACITY];
+    size_t first;
+    size_t last;
+    size_t stream_first;
+    size_t stream_last;
+};
+
+void test_aesd_circular_arena_init_rejects_bad_capacity()
+{
+    struct aesd_circular_arena arena;
+    char data[TEST_ARENA_CAPACITY];
+
+    TEST_ASSERT_EQUAL_INT(-EINVAL, aesd_circular_arena_init(&arena, data, 0));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, aesd_circular_arena_init(&arena, data, 48));
+    TEST_ASSERT_EQUAL_INT(0, aesd_circular_arena_init(&arena, data, TEST_ARENA_CAPACITY));
+    TEST_ASSERT_EQUAL_UINT(0, aesd_circular_arena_entry_count(&arena));
+    TEST_ASSERT_EQUAL_UINT(0, aesd_circular_arena_read(&arena, 0, data, sizeof(data)));
+}
+
+void test_aesd_circular_arena_rejects_oversized_entry()
+{
+    struct aesd_circular_arena arena;
+    char data[TEST_ARENA_CAPACITY];
+    char big[TEST_ARENA_CAPACITY + 1];
+
+    memset(big, 'x', sizeof(big));
+    aesd_circular_arena_init(&arena, data, TEST_ARENA_CAPACITY);
+    TEST_ASSERT_EQUAL_INT(0, aesd_circular_arena_add_entry(&arena, "abc\n", 4));
+    TEST_ASSERT_EQUAL_INT(-EINVAL, aesd_circular_arena_add_entry(&arena, big, sizeof(big)));
+    TEST_ASSERT_EQUAL_UINT(1, aesd_circular_arena_entry_count(&arena));
+    // an entry filling the whole arena evicts everything else
+    TEST_ASSERT_EQUAL_INT(1, aesd_circular_arena_add_entry(&arena, big, TEST_ARENA_CAPACITY));
+    TEST_ASSERT_EQUAL_UINT(TEST_ARENA_CAPACITY, aesd_circular_arena_total_size(&arena));
+}
+
+/**
+ * Random entries, many of them wrapping around the end of the arena, checking evictions,
+ * position lookups and reads of random ranges against the model after every add
+ */
+void test_aesd_circular_arena_matches_model()
+{
+    static struct test_arena_model model;
+    struct aesd_circular_arena arena;
+    char data[TEST_ARENA_CAPACITY];
+    char entry[TEST_ARENA_CAPACITY];
+    char out[TEST_ARENA_CAPACITY];
+
+    srand(11);
+    memset(&model, 0, sizeof(model));
+    TEST_ASSERT_EQUAL_INT(0, aesd_circular_arena_init(&arena, data, TEST_ARENA_CAPACITY));
+    for (size_t op = 0; op < TEST_ARENA_OPERATIONS; op++) {
+        size_t size = 1 + rand() % (TEST_ARENA_CAPACITY / 2);
+        int evicted = 0;
+        size_t total;
+
+        for (size_t i = 0; i < size; i++) {
+            entry[i] = 'a' + rand() % 26;
+        }
+        while (model.stream_last - model.stream_first + size > TEST_ARENA_CAPACITY) {
+            model.stream_first += model.sizes[model.first++];
+            evicted++;
+        }
+        memcpy(model.stream + model.stream_last, entry, size);
+        model.stream_last += size;
+        model.sizes[model.last++] = size;
+        TEST_ASSERT_EQUAL_INT(evicted, aesd_circular_arena_add_entry(&arena, entry, size));
+
+        total = model.stream_last - model.stream_first;
+        TEST_ASSERT_EQUAL_UINT(model.last - model.first, aesd_circular_arena_entry_count(&arena));
+        TEST_ASSERT_EQUAL_UINT(total, aesd_circular_arena_total_size(&arena));
+        for (size_t i = model.first, fpos = 0; i < model.last; fpos += model.sizes[i++]) {
+            size_t offset;
+            struct aesd_arena_entry *found;
+            found = aesd_circular_arena_find_entry_offset_for_fpos(&arena, fpos + model.sizes[i] - 1, &offset);
+            TEST_ASSERT_NOT_NULL(found);
+            TEST_ASSERT_EQUAL_UINT(model.sizes[i], found->size);
+            TEST_ASSERT_EQUAL_UINT(model.sizes[i] - 1, offset);
+        }
+        for (int read = 0; read < 4; read++) {
+            size_t from = rand() % total;
+            size_t len = rand() % (TEST_ARENA_CAPACITY + 1);
+            size_t expected = len < total - from ? len : total - from;
+            TEST_ASSERT_EQUAL_UINT(expected, aesd_circular_arena_read(&arena, from, out, len));
+            TEST_ASSERT_EQUAL_MEMORY(model.stream + model.stream_first + from, out, expected);
+        }
+        TEST_ASSERT_EQUAL_UINT(0, aesd_circular_arena_read(&arena, total, out, sizeof(out)));
+    }
+}
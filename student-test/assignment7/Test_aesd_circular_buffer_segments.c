@@ -0,0 +1,112 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+/**
+ * Checks aesd_circular_buffer_segments against the concatenation of the entries the buffer
+ * should hold: the segments must cover exactly the requested range of it.
+ */
+
+#define TEST_SEGMENTS_OPERATIONS 2000
+#define TEST_SEGMENTS_MAX_ENTRY 16
+
+/**
+ * Copies @param count segments into @param out, returning the bytes copied
+ */
+static size_t test_segments_join(const struct aesd_buffer_segment *segments, size_t count, char *out)
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < count; i++) {
+        TEST_ASSERT_NOT_NULL(segments[i].ptr);
+        TEST_ASSERT_TRUE(segments[i].len > 0);
+        memcpy(out + bytes, segments[i].ptr, segments[i].len);
+        bytes += segments[i].len;
+    }
+    return bytes;
+}
+
+void test_aesd_circular_buffer_segments_empty_and_past_end()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entry = { .buffptr = "abc\n", .size = 4 };
+    struct aesd_buffer_segment segments[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    size_t bytes = 1;
+
+    aesd_circular_buffer_init(&buffer);
+    TEST_ASSERT_EQUAL_UINT(0, aesd_circular_buffer_segments(&buffer, 0, 10, segments, 10, &bytes));
+    TEST_ASSERT_EQUAL_UINT(0, bytes);
+    aesd_circular_buffer_add_entry(&buffer, &entry);
+    TEST_ASSERT_EQUAL_UINT(0, aesd_circular_buffer_segments(&buffer, 4, 10, segments, 10, &bytes));
+    TEST_ASSERT_EQUAL_UINT(0, bytes);
+    TEST_ASSERT_EQUAL_UINT(0, aesd_circular_buffer_segments(&buffer, 1, 0, segments, 10, &bytes));
+    TEST_ASSERT_EQUAL_UINT(0, bytes);
+    TEST_ASSERT_EQUAL_UINT(1, aesd_circular_buffer_segments(&buffer, 1, 10, segments, 10, NULL));
+    TEST_ASSERT_EQUAL_PTR(entry.buffptr + 1, segments[0].ptr);
+    TEST_ASSERT_EQUAL_UINT(3, segments[0].len);
+}
+
+/**
+ * Random entries and random ranges, with max_segments limiting how many entries a call
+ * may span
+ */
+void test_aesd_circular_buffer_segments_matches_model()
+{
+    static char storage[TEST_SEGMENTS_OPERATIONS][TEST_SEGMENTS_MAX_ENTRY];
+    size_t sizes[TEST_SEGMENTS_OPERATIONS];
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_segment segments[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    char expected[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * TEST_SEGMENTS_MAX_ENTRY];
+    char out[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * TEST_SEGMENTS_MAX_ENTRY];
+
+    srand(5);
+    aesd_circular_buffer_init(&buffer);
+    for (size_t op = 0; op < TEST_SEGMENTS_OPERATIONS; op++) {
+        struct aesd_buffer_entry entry;
+        const char *overwritten;
+        size_t first = op + 1 > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
+                ? op + 1 - AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED : 0;
+        size_t total = 0;
+
+        sizes[op] = 1 + rand() % TEST_SEGMENTS_MAX_ENTRY;
+        for (size_t i = 0; i < sizes[op]; i++) {
+            storage[op][i] = 'a' + rand() % 26;
+        }
+        entry.buffptr = storage[op];
+        entry.size = sizes[op];
+        overwritten = aesd_circular_buffer_add_entry(&buffer, &entry);
+        TEST_ASSERT_EQUAL_PTR(first > 0 ? storage[first - 1] : NULL, overwritten);
+
+        for (size_t i = first; i <= op; i++) {
+            memcpy(expected + total, storage[i], sizes[i]);
+            total += sizes[i];
+        }
+        for (int call = 0; call < 8; call++) {
+            size_t offset = rand() % (total + 2);
+            size_t len = rand() % (total + 2);
+            size_t max_segments = 1 + rand() % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+            size_t want = offset < total ? (len < total - offset ? len : total - offset) : 0;
+            size_t count;
+            size_t bytes;
+            size_t overlapping = 0;
+
+            count = aesd_circular_buffer_segments(&buffer, offset, len, segments, max_segments, &bytes);
+            TEST_ASSERT_TRUE(count <= max_segments);
+            TEST_ASSERT_EQUAL_UINT(bytes, test_segments_join(segments, count, out));
+            TEST_ASSERT_TRUE(bytes <= want);
+            TEST_ASSERT_EQUAL_MEMORY(expected + offset, out, bytes);
+            if (bytes < want) {
+                // only running out of segments may cut the range short
+                TEST_ASSERT_EQUAL_UINT(max_segments, count);
+            }
+            // one segment per entry overlapping the bytes returned
+            for (size_t i = first, start = 0; i <= op; start += sizes[i++]) {
+                if (bytes > 0 && start < offset + bytes && start + sizes[i] > offset) {
+                    overlapping++;
+                }
+            }
+            TEST_ASSERT_EQUAL_UINT(overlapping, count);
+        }
+    }
+}
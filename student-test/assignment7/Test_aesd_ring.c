@@ -0,0 +1,167 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-ring.h"
+
+/**
+ * Checks the aesd-ring macros against a plain array model of the same queue, including
+ * free running counters and byte offsets which wrap around past their maximum value.
+ */
+
+#define TEST_RING_ORDER 3
+#define TEST_RING_CAPACITY AESD_RING_CAPACITY(TEST_RING_ORDER)
+#define TEST_RING_OPERATIONS 20000
+
+struct test_ring_elem
+{
+    size_t size;
+    uint32_t id;
+};
+
+AESD_RING_DECLARE(test_plain_ring, uint32_t, TEST_RING_ORDER)
+AESD_RING_DECLARE_SIZED(test_sized_ring, struct test_ring_elem, TEST_RING_ORDER, size)
+
+/**
+ * The reference model: every element ever added, the stored ones being [first, last)
+ */
+struct test_ring_model
+{
+    struct test_ring_elem elems[TEST_RING_OPERATIONS];
+    size_t first;
+    size_t last;
+};
+
+static size_t model_total_size(const struct test_ring_model *model)
+{
+    size_t total = 0;
+    for (size_t i = model->first; i < model->last; i++) {
+        total += model->elems[i].size;
+    }
+    return total;
+}
+
+void test_aesd_ring_add_pop_in_order()
+{
+    struct test_plain_ring ring;
+    uint32_t value;
+
+    test_plain_ring_init(&ring);
+    TEST_ASSERT_FALSE(test_plain_ring_pop(&ring, &value));
+    TEST_ASSERT_NULL(test_plain_ring_at(&ring, 0));
+    for (uint32_t i = 0; i < 5; i++) {
+        TEST_ASSERT_FALSE(test_plain_ring_add(&ring, &i, NULL));
+    }
+    TEST_ASSERT_EQUAL_UINT32(5, test_plain_ring_count(&ring));
+    TEST_ASSERT_EQUAL_UINT32(3, *test_plain_ring_at(&ring, 3));
+    TEST_ASSERT_NULL(test_plain_ring_at(&ring, 5));
+    for (uint32_t i = 0; i < 5; i++) {
+        TEST_ASSERT_TRUE(test_plain_ring_pop(&ring, &value));
+        TEST_ASSERT_EQUAL_UINT32(i, value);
+    }
+    TEST_ASSERT_FALSE(test_plain_ring_pop(&ring, &value));
+}
+
+void test_aesd_ring_full_add_evicts_oldest()
+{
+    struct test_plain_ring ring;
+    uint32_t evicted;
+
+    test_plain_ring_init(&ring);
+    for (uint32_t i = 0; i < TEST_RING_CAPACITY; i++) {
+        TEST_ASSERT_FALSE(test_plain_ring_add(&ring, &i, &evicted));
+    }
+    TEST_ASSERT_TRUE(test_plain_ring_full(&ring));
+    for (uint32_t i = TEST_RING_CAPACITY; i < TEST_RING_CAPACITY + 3; i++) {
+        TEST_ASSERT_TRUE(test_plain_ring_add(&ring, &i, &evicted));
+        TEST_ASSERT_EQUAL_UINT32(i - TEST_RING_CAPACITY, evicted);
+    }
+    TEST_ASSERT_EQUAL_UINT32(TEST_RING_CAPACITY, test_plain_ring_count(&ring));
+    TEST_ASSERT_EQUAL_UINT32(3, *test_plain_ring_at(&ring, 0));
+    TEST_ASSERT_EQUAL_UINT32(TEST_RING_CAPACITY + 2, *test_plain_ring_at(&ring, TEST_RING_CAPACITY - 1));
+}
+
+void test_aesd_ring_counters_wrap_around()
+{
+    struct test_plain_ring ring;
+    uint32_t value;
+
+    test_plain_ring_init(&ring);
+    ring.head = UINT32_MAX - 8;
+    ring.tail = UINT32_MAX - 8;
+    for (uint32_t i = 0; i < TEST_RING_CAPACITY + 4; i++) {
+        test_plain_ring_add(&ring, &i, NULL);
+    }
+    TEST_ASSERT_TRUE(ring.head < ring.tail);
+    TEST_ASSERT_EQUAL_UINT32(TEST_RING_CAPACITY, test_plain_ring_count(&ring));
+    TEST_ASSERT_TRUE(test_plain_ring_full(&ring));
+    for (uint32_t i = 4; i < TEST_RING_CAPACITY + 4; i++) {
+        TEST_ASSERT_TRUE(test_plain_ring_pop(&ring, &value));
+        TEST_ASSERT_EQUAL_UINT32(i, value);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, test_plain_ring_count(&ring));
+}
+
+/**
+ * Random adds and pops on a sized ring whose counters and byte offsets start just short
+ * of wrapping, comparing every position lookup with the model
+ */
+void test_aesd_ring_sized_matches_model()
+{
+    static struct test_ring_model model;
+    struct test_sized_ring ring;
+    struct test_ring_elem elem;
+    struct test_ring_elem *found;
+    size_t offset;
+    size_t fpos;
+
+    srand(7);
+    memset(&model, 0, sizeof(model));
+    test_sized_ring_init(&ring);
+    ring.ring.head = UINT32_MAX - 100;
+    ring.ring.tail = UINT32_MAX - 100;
+    ring.base_offs = SIZE_MAX - 5000;
+    for (uint32_t op = 0; op < TEST_RING_OPERATIONS; op++) {
+        if (rand() % 4 == 0) {
+            bool popped = test_sized_ring_pop(&ring, &elem);
+            TEST_ASSERT_EQUAL(model.first < model.last, popped);
+            if (popped) {
+                TEST_ASSERT_EQUAL_UINT32(model.elems[model.first].id, elem.id);
+                model.first++;
+            }
+        }
+        else {
+            struct test_ring_elem evicted;
+            bool full = model.last - model.first == TEST_RING_CAPACITY;
+            elem.size = rand() % 50;
+            elem.id = op;
+            TEST_ASSERT_EQUAL(full, test_sized_ring_add(&ring, &elem, &evicted));
+            if (full) {
+                TEST_ASSERT_EQUAL_UINT32(model.elems[model.first].id, evicted.id);
+                model.first++;
+            }
+            model.elems[model.last++] = elem;
+        }
+
+        TEST_ASSERT_EQUAL_UINT32(model.last - model.first, test_sized_ring_count(&ring));
+        TEST_ASSERT_EQUAL_UINT(model_total_size(&model), test_sized_ring_total_size(&ring));
+        fpos = 0;
+        for (size_t i = model.first; i < model.last; i++) {
+            size_t ring_fpos;
+            found = test_sized_ring_fpos_for(&ring, i - model.first, &ring_fpos);
+            TEST_ASSERT_NOT_NULL(found);
+            TEST_ASSERT_EQUAL_UINT32(model.elems[i].id, found->id);
+            TEST_ASSERT_EQUAL_UINT(fpos, ring_fpos);
+            for (size_t byte = 0; byte < model.elems[i].size; byte += 7) {
+                found = test_sized_ring_find_fpos(&ring, fpos + byte, &offset);
+                TEST_ASSERT_NOT_NULL(found);
+                TEST_ASSERT_EQUAL_UINT32(model.elems[i].id, found->id);
+                TEST_ASSERT_EQUAL_UINT(byte, offset);
+            }
+            fpos += model.elems[i].size;
+        }
+        TEST_ASSERT_NULL(test_sized_ring_fpos_for(&ring, model.last - model.first, &offset));
+        TEST_ASSERT_NULL(test_sized_ring_find_fpos(&ring, fpos, &offset));
+    }
+}